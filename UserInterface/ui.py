@@ -1,6 +1,6 @@
 import sys
 from PyQt5.QtWidgets import QApplication, QMainWindow, QLabel, QVBoxLayout, QWidget, QTabWidget
-from PyQt5.QtCore import QTimer
+from PyQt5.QtCore import QTimer, QSocketNotifier
 import sqlite3
 import matplotlib.pyplot as plt
 from matplotlib.backends.backend_qt5agg import FigureCanvasQTAgg as FigureCanvas
@@ -136,12 +136,20 @@ class MainWindow( QMainWindow ):
     def __init__( self, ip_address ):
         super().__init__()
         self.ip_address = ip_address
+        self.timestamps = []
+        self.temperatures = []
+        self.humidities = []
+        self.pressures = []
+        self.pending = ''
+        self.subscription = None
         self.initUI()
-        self.updateScreen()
-        # Create a QTimer instance to update the screen periodically
+
+        # Create a QTimer instance to update the screen periodically if subscribing is not possible
         self.timer = QTimer( self )
         self.timer.timeout.connect( self.updateScreen )  # Connect timeout signal to function
-        self.timer.start( 15000 )  # Start timer with a timeout interval of 15,000 milliseconds ( 15 seconds )
+
+        self.updateScreen()
+        self.subscribe()
 
     def initUI( self ):
         self.setGeometry( 100, 100, 800, 600 )  # Set window size and position
@@ -183,26 +191,55 @@ class MainWindow( QMainWindow ):
         # Set the central widget as the tab widget
         self.setCentralWidget( self.tabWidget )
 
-        # Connect tab change signal to updateScreen method
-        self.tabWidget.currentChanged.connect( self.updateScreen )
-
-    def updateScreen( self ):
-        # Determine which tab is selected
-        current_tab_index = self.tabWidget.currentIndex()
-
-        # Make socket call to 10.0.0.160 port 9000 with the command "get10"
-        with socket.socket( socket.AF_INET, socket.SOCK_STREAM ) as s:
-            s.connect( ( self.ip_address, 9000 ) )
-            s.sendall( b'get10' )
-            received_data = s.recv( 1536 )
-
-        # Parse received data and plot accordingly
-        data_lines = received_data.decode( 'utf-8' ).split( '\n' )
-        timestamps = []
-        temperatures = []
-        humidities = []
-        pressures = []
-
+        # Connect tab change signal to redraw the samples already received
+        self.tabWidget.currentChanged.connect( self.plotCurrentTab )
+
+    def subscribe( self ):
+        # Ask the server to push every new sample instead of polling every 15 seconds
+        try:
+            self.subscription = socket.create_connection( ( self.ip_address, 9000 ) )
+            self.subscription.sendall( b'subscribe' )
+            self.subscription.setblocking( False )
+        except OSError as e:
+            print( "Subscribe failed, polling instead:", e )
+            self.subscription = None
+            self.timer.start( 15000 )  # Start timer with a timeout interval of 15,000 milliseconds ( 15 seconds )
+            return
+
+        # Read pushed samples from the Qt event loop
+        self.notifier = QSocketNotifier( self.subscription.fileno(), QSocketNotifier.Read, self )
+        self.notifier.activated.connect( self.receivePushed )
+
+    def receivePushed( self ):
+        try:
+            received_data = self.subscription.recv( 4096 )
+        except BlockingIOError:
+            return
+        except OSError:
+            received_data = b''
+
+        if not received_data:
+            # Server went away, fall back to polling
+            self.notifier.setEnabled( False )
+            self.subscription.close()
+            self.subscription = None
+            self.timer.start( 15000 )
+            return
+
+        # Only complete lines are parsed, a partial one waits for the next read
+        self.pending += received_data.decode( 'utf-8' )
+        lines = self.pending.split( '\n' )
+        self.pending = lines.pop()
+        self.parseLines( lines )
+
+        # Keep the same window of samples as get10
+        del self.timestamps[:-10]
+        del self.temperatures[:-10]
+        del self.humidities[:-10]
+        del self.pressures[:-10]
+        self.plotCurrentTab()
+
+    def parseLines( self, data_lines ):
         for line in data_lines:
             if line:
                 parts = line.split( ',' )
@@ -213,25 +250,44 @@ class MainWindow( QMainWindow ):
                         humidity = float( parts[2].split( ':' )[1].strip() )  # Extract humidity from the line
                         pressure = float( parts[3].split( ':' )[1].strip() )  # Extract pressure from the line
 
-                        timestamps.append( timestamp )  # Append timestamp to timestamps list
-                        temperatures.append( temperature )  # Append temperature to temperatures list
-                        humidities.append( humidity )  # Append humidity to humidities list
-                        pressures.append( pressure )  # Append pressure to pressures list
+                        self.timestamps.append( timestamp )  # Append timestamp to timestamps list
+                        self.temperatures.append( temperature )  # Append temperature to temperatures list
+                        self.humidities.append( humidity )  # Append humidity to humidities list
+                        self.pressures.append( pressure )  # Append pressure to pressures list
                     except ( IndexError, ValueError ) as e:
                         print( "Invalid data format:", line )  # Print error message for invalid data
                         continue
                 else:
                     print( "Invalid data format:", line )  # Print error message for invalid data
 
+    def updateScreen( self ):
+        # Make socket call to 10.0.0.160 port 9000 with the command "get10"
+        with socket.socket( socket.AF_INET, socket.SOCK_STREAM ) as s:
+            s.connect( ( self.ip_address, 9000 ) )
+            s.sendall( b'get10' )
+            received_data = s.recv( 1536 )
+
+        # Parse received data, get10 returns the newest entry first
+        self.timestamps = []
+        self.temperatures = []
+        self.humidities = []
+        self.pressures = []
+        self.parseLines( reversed( received_data.decode( 'utf-8' ).split( '\n' ) ) )
+        self.plotCurrentTab()
+
+    def plotCurrentTab( self ):
+        # Determine which tab is selected
+        current_tab_index = self.tabWidget.currentIndex()
+
         # Update the graph when the screen is updated
         if current_tab_index == 0:  # Temperature tab
-            self.graphWidget_temperature.plot_temperature( timestamps, temperatures )
+            self.graphWidget_temperature.plot_temperature( self.timestamps, self.temperatures )
         elif current_tab_index == 1:  # Humidity tab
-            self.graphWidget_humidity.plot_humidity( timestamps, humidities )
+            self.graphWidget_humidity.plot_humidity( self.timestamps, self.humidities )
         elif current_tab_index == 2:  # Pressure tab
-            self.graphWidget_pressure.plot_pressure( timestamps, pressures )
+            self.graphWidget_pressure.plot_pressure( self.timestamps, self.pressures )
         elif current_tab_index == 3:  # All tab
-            self.graphWidget_all.plot_data( timestamps, temperatures, humidities, pressures )
+            self.graphWidget_all.plot_data( self.timestamps, self.temperatures, self.humidities, self.pressures )
 
 
 
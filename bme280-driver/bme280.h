@@ -30,10 +30,18 @@
 #endif
 
 #include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "bme280_ioctl.h"
+#include "bme280_calc.h"
 
 #define CALIB_DATA_PT_LEN (24)
 #define LONG_SIGNED_INT_NUM (1)
 #define MEASUREMENT_LEN (25)
+#define BME280_MAX_DEVICES (8)      // Sensors a single module instance can drive
+#define BME280_FIFO_SAMPLES (64)    // Normal mode buffer, must be a power of 2
 
 // Only for Temperature and Pressure
 enum calib_data_digits
@@ -52,13 +60,41 @@ enum calib_data_digits
     dig_P9
 };
 
-
 struct bme280_dev
 {
     struct cdev cdev;     /* Char device structure */
     struct i2c_adapter *bme280_i2c_adapter;
     struct i2c_client *bme280_i2c_client;
-    uint8_t calib_data[CALIB_DATA_PT_LEN];
+    struct bme280_calib calib;
+    struct bme280_calib_block calib_raw;  /* As read from NVM, for userspace */
+    uint8_t ctrl_meas;    /* Last value written to ctrl_meas, mode = sleep */
+    uint8_t ctrl_hum;     /* Last value written to ctrl_hum */
+    uint8_t filter;       /* IIR filter setting in config[4:2] */
+    struct mutex lock;    /* Serializes measurements on the sensor */
+    u32 sequence;         /* Sequence number of the last sample taken */
+
+    struct mutex config_lock;         /* Serializes configuration changes */
+
+    /* Normal mode sampling */
+    bool normal_mode;
+    unsigned int standby_us;          /* Standby time of the selected t_sb */
+    unsigned int period_us;           /* Conversion plus standby time */
+    unsigned long next_sample;        /* jiffies when the next sample is due */
+    struct delayed_work sample_work;
+    DECLARE_KFIFO(fifo, struct bme280_sample, BME280_FIFO_SAMPLES);
+    struct mutex read_lock;           /* Serializes FIFO readers */
+    wait_queue_head_t read_wait;
+    u32 overruns;                     /* Samples dropped on a full FIFO */
+
+    struct bme280_ring *ring;         /* Shared with userspace through mmap */
+    u32 ring_head;                    /* Producer index, ring -> head mirrors it */
+};
+
+// Per open file state
+struct bme280_file
+{
+    struct bme280_dev *dev;
+    int read_mode;        /* BME280_READ_TEXT or BME280_READ_BINARY */
 };
 
 
@@ -0,0 +1,129 @@
+/**
+ * @file    bme280_calc.h
+ * @brief   Per-sample temperature and pressure compensation of the BME280
+ *          driver
+ *
+ * Kept free of driver state so the exact code the driver runs can also be
+ * built on a host, see measure/bme280_compensate_bench.c. Note that long is
+ * 32 bits on the ARM boards and 64 bits on most hosts.
+ *
+ * @ref    BME280 Datasheet, section 4.2.3
+ *
+ */
+
+#ifndef BME280_CALC_H_
+#define BME280_CALC_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <asm/div64.h>  // do_div
+#else
+#include <stdint.h>
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+// Same contract as the kernel's do_div: n is divided in place by a 32-bit
+// divisor and the remainder is returned
+#define do_div(n, base) ({                      \
+        u32 __base = (base);                    \
+        u32 __rem = ((u64)(n)) % __base;        \
+        (n) = ((u64)(n)) / __base;              \
+        __rem;                                  \
+    })
+#endif
+
+#define P_CALC (128000)
+#define P_CALC_2 (1048576)
+
+// Calibration coefficients decoded from NVM, plus terms of the compensation
+// formulas that only depend on them. Filled once by bme280_init_sensor().
+struct bme280_calib
+{
+    u16 dig_T1;
+    s16 dig_T2;
+    s16 dig_T3;
+    u16 dig_P1;
+    s16 dig_P2;
+    s16 dig_P3;
+    s16 dig_P4;
+    s16 dig_P5;
+    s16 dig_P6;
+    s16 dig_P7;
+    s16 dig_P8;
+    s16 dig_P9;
+
+    s32 t1_x2;            /* dig_T1 << 1 */
+    s64 p4_shifted;       /* dig_P4 << 35 */
+    s64 p7_shifted;       /* dig_P7 << 4 */
+};
+
+// Fill in the derived terms once the coefficients are decoded
+static inline void bme280_calib_derive(struct bme280_calib *calib)
+{
+    calib -> t1_x2 = ((s32)calib -> dig_T1) << 1;
+    calib -> p4_shifted = ((s64)calib -> dig_P4) << 35;
+    calib -> p7_shifted = ((s64)calib -> dig_P7) << 4;
+}
+
+// Assemble a 20-bit ADC value from its msb [19:12], lsb [11:4] and xlsb [3:0] registers
+static inline long signed int bme280_adc20(const u8 *data)
+{
+    return ((long signed int)data[0] << 12) | ((long signed int)data[1] << 4) | (data[2] >> 4);
+}
+
+// Compensate a raw pressure reading, using the t_fine of the same conversion.
+// Returns -1 where the formula would divide by zero.
+static inline long unsigned int bme280_pressure_compensate(const struct bme280_calib *calib, long signed int adc_P, s32 t_fine)
+{
+    long long signed int var1, var2, P;
+
+    // Reference: BME280 datasheet
+    var1 = ((long long signed int)t_fine) - P_CALC;
+    var2 = var1 * var1 * ((long long signed int)calib -> dig_P6);
+    var2 = var2 + ((var1 * (long long signed int)calib -> dig_P5) << 17);
+    var2 = var2 + calib -> p4_shifted;
+    var1 = ((var1 * var1 * (long long signed int)calib -> dig_P3) >> 8) + ((var1 * (long long signed int)calib -> dig_P2) << 12);
+    var1 = (((((long long signed int)1) << 47) + var1)) * ((long long signed int)calib -> dig_P1) >> 33;
+
+    // Check for zero before dividing
+    if (var1 == 0)
+    {
+        return -1;
+    }
+
+    P = P_CALC_2 - adc_P;
+    P = (((P << 31) - var2) * 3125);
+    do_div(P, var1);
+    var1 = (((long long signed int)calib -> dig_P9) * (P >> 13) * (P >> 13)) >> 25;
+    var2 = (((long long signed int)calib -> dig_P8) * P) >> 19;
+    P = ((P + var1 + var2) >> 8) + calib -> p7_shifted;
+
+    return (long unsigned int)P;
+
+}
+
+
+// Compensate a raw temperature reading. t_fine carries the fine resolution
+// temperature that pressure compensation needs.
+static inline long signed int bme280_temp_compensate(const struct bme280_calib *calib, long signed int adc_T, s32 *t_fine)
+{
+    long signed int var1, var2, T;
+
+    // Compensation for possible errors in sensor data
+    // Reference for logic: BME280 Datasheet
+    var1 = (((adc_T >> 3) - calib -> t1_x2) * ((long signed int) calib -> dig_T2)) >> 11;
+    var2 = (((((adc_T >> 4) - ((long signed int) calib -> dig_T1)) * ((adc_T >> 4) - ((long signed int) calib -> dig_T1))) >> 12) *
+        ((long signed int) calib -> dig_T3)) >> 14;
+
+    *t_fine = var1 + var2;
+
+    T = (*t_fine * 5 + 128) >> 8;
+    return T;
+}
+
+#endif /* BME280_CALC_H_ */
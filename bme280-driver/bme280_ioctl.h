@@ -0,0 +1,116 @@
+/**
+ * @file    bme280_ioctl.h
+ * @brief   Binary sample ABI and ioctl definitions shared by the BME280
+ *          driver and userspace
+ *
+ * @author  Ritika Ramchandani
+ * @date    2023-04-12
+ *
+ */
+
+#ifndef BME280_IOCTL_H_
+#define BME280_IOCTL_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * One measurement as returned by BME280_IOCGSAMPLE, or by read() once the
+ * file is in BME280_READ_BINARY mode. The layout is fixed: fields only ever
+ * get appended, and the size is always a multiple of 8 bytes.
+ */
+struct bme280_sample
+{
+    __s64 timestamp_ns;     // CLOCK_REALTIME when the conversion finished
+    __u32 sequence;         // Incremented for every sample the driver takes
+    __s32 adc_T;            // Raw 20-bit temperature ADC value
+    __s32 adc_P;            // Raw 20-bit pressure ADC value
+    __s32 temperature;      // Compensated, in 0.01 degC
+    __u32 pressure;         // Compensated, in Pa as Q24.8
+    __u32 wait_us;          // Time the driver waited for the conversion
+    __s32 adc_H;            // Raw 16-bit humidity ADC value
+    __u32 reserved;
+};
+
+/**
+ * Ring of the most recent samples, mapped read-only with mmap() on
+ * /dev/bme280. Every sample the driver takes is published here, in forced
+ * and in normal mode.
+ *
+ * To publish sample n, the driver sets write_seq to n + 1, issues
+ * smp_wmb(), writes samples[n % BME280_RING_SAMPLES] and then stores
+ * head = n + 1 with release semantics. It never waits for consumers, so a
+ * slow consumer gets lapped. Consumers keep their own position; to read
+ * sample i: load head with acquire semantics and check i < head, copy
+ * samples[i % BME280_RING_SAMPLES], issue smp_rmb() (an acquire fence in
+ * C11 terms), then load write_seq. If write_seq - i > BME280_RING_SAMPLES,
+ * sample i + BME280_RING_SAMPLES had started overwriting the slot and the
+ * copy may be torn, so it is lost.
+ */
+#define BME280_RING_SAMPLES (256)   // Power of 2
+
+struct bme280_ring
+{
+    __u32 head;                     // Samples published, free running
+    __u32 write_seq;                // Sample writes started, free running
+    __u32 size;                     // BME280_RING_SAMPLES
+    __u32 record_size;              // sizeof(struct bme280_sample)
+    __u32 pad[12];                  // Samples start on their own cache line
+    struct bme280_sample samples[BME280_RING_SAMPLES];
+};
+
+/**
+ * Calibration NVM exactly as stored on the sensor, for compensating raw
+ * samples in userspace. Decoding follows the datasheet, section 4.2.2.
+ */
+#define BME280_CALIB_TP_LEN (26)    // 0x88..0xA1: dig_T*, dig_P*, dig_H1
+#define BME280_CALIB_H_LEN (7)      // 0xE1..0xE7: dig_H2..dig_H6
+
+struct bme280_calib_block
+{
+    __u8 tp[BME280_CALIB_TP_LEN];
+    __u8 h[BME280_CALIB_H_LEN];
+    __u8 pad[3];
+};
+
+/**
+ * Sensor settings for BME280_IOCGCONFIG and BME280_IOCSCONFIG. On set, the
+ * reported fields are ignored and come back filled in for the settings
+ * that were applied.
+ */
+struct bme280_config
+{
+    __u8 osrs_t;            // Oversampling: 1..5 = x1, x2, x4, x8, x16
+    __u8 osrs_p;            // Same as osrs_t
+    __u8 osrs_h;            // Same, plus 0 = humidity skipped
+    __u8 filter;            // IIR filter: 0 = off, 1..4 = coefficient 2, 4, 8, 16
+    __u32 standby_us;       // 0 = forced mode, else normal mode with the
+                            // longest supported standby not above this
+    __u32 measure_time_us;  // Reported: maximum conversion time
+    __u32 period_us;        // Reported: sample period, 0 in forced mode
+};
+
+#define BME280_OSRS_MAX (5)
+#define BME280_FILTER_MAX (4)
+
+// read() formats, selected per open file with BME280_IOCSMODE
+#define BME280_READ_TEXT    (0)     // "<temperature> <pressure>" string, the default
+#define BME280_READ_BINARY  (1)     // One struct bme280_sample per read
+
+#define BME280_IOC_MAGIC 0x1E
+
+// Take a measurement and return it without formatting
+#define BME280_IOCGSAMPLE _IOR(BME280_IOC_MAGIC, 1, struct bme280_sample)
+// Select the read() format of this open file
+#define BME280_IOCSMODE _IOW(BME280_IOC_MAGIC, 2, int)
+// Read the current sensor settings
+#define BME280_IOCGCONFIG _IOR(BME280_IOC_MAGIC, 3, struct bme280_config)
+// Apply new sensor settings and report the result
+#define BME280_IOCSCONFIG _IOWR(BME280_IOC_MAGIC, 4, struct bme280_config)
+
+// Read the sensor's raw calibration block
+#define BME280_IOCGCALIB _IOR(BME280_IOC_MAGIC, 5, struct bme280_calib_block)
+
+#define BME280_IOC_MAXNR 5
+
+#endif /* BME280_IOCTL_H_ */
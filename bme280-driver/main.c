@@ -17,7 +17,17 @@
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
 #include "bme280.h"
+#include "bme280_ioctl.h"
 #include <linux/slab.h>	// kmalloc, krealloc, kfree
+#include <linux/uaccess.h> // copy_to_user, copy_from_user, get_user
+#include <linux/timekeeping.h>
+#include <linux/delay.h> // usleep_range
+#include <linux/poll.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h> // vmalloc_user, remap_vmalloc_range
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <asm/unaligned.h> // get_unaligned_le16
 
 #ifdef __KERNEL__
 #include <linux/string.h>
@@ -26,9 +36,13 @@
 #endif
 
 #define CALIB_ADDR (0x88)
+#define CALIB_H_ADDR (0xE1)
 #define CALIB_DATA_T_LEN (6)
-#define TEMP_REG_ADDR (0xFA)
-#define PRESSURE_REG_ADDR (0xF7)
+#define DATA_REG_ADDR (0xF7)    // press_msb, first of the measurement registers
+#define DATA_REG_LEN (8)        // press[3], temp[3], hum[2] up to 0xFE
+#define PRESSURE_DATA_OFFSET (0)
+#define TEMP_DATA_OFFSET (3)
+#define HUM_DATA_OFFSET (6)
 #define BME280_SENSOR_ADDR (0x77)
 #define BME280_STATUS_REG_ADDR (0xF3)
 #define BME280_CHIP_ID_REG_ADDR (0xD0)
@@ -36,13 +50,20 @@
 #define BME280_CONFIG_REG_ADDR (0xF5)
 #define BME280_CTRL_MEAS_REG_ADDR (0xF4)
 #define IIR_FILTER_BIT_MASK (0x1C)
+#define FILTER_LSB (2)
+#define BME280_CTRL_HUM_REG_ADDR (0xF2)
 #define MODE_LSB (0)
 #define OSRS_P_LSB (2) 
 #define OSRS_T_LSB (5)
 #define SLEEP_MASK (0xFC)
-#define MEASUREMENT_IN_PROGRESS (0x00001001)
-#define P_CALC (128000)
-#define P_CALC_2 (1048576)
+#define MODE_NORMAL (0x03)
+#define STANDBY_LSB (5)
+#define STANDBY_MASK (0xE0)
+#define OSRS_MASK (0x07)
+#define STATUS_MEASURING (0x08)   // status[3], set while a conversion is running
+#define STATUS_POLL_MAX (5)       // Status checks after the expected conversion time
+#define STATUS_POLL_US (500)      // Delay between those checks
+#define BME280_FIFO_STOPPED (1)   // bme280_wait_fifo: normal mode ended, measure instead
 
 
 int bme280_major =   0; // use dynamic major
@@ -51,8 +72,30 @@ int bme280_minor =   0;
 MODULE_AUTHOR("Ritika Ramchandani"); 
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct bme280_dev bme280_device;
-long signed int tFine;
+// Sensors to drive. Each addr entry is one sensor and one minor number, on
+// the adapter at the same index in bus, or on bus[0] if only one is given.
+// Without parameters there is a single sensor at 0x77 on adapter 1.
+static int bus[BME280_MAX_DEVICES] = { 1 };
+static int num_bus = 0;
+module_param_array(bus, int, &num_bus, 0444);
+MODULE_PARM_DESC(bus, "I2C adapter number of each sensor, or one for all (default 1)");
+
+static ushort addr[BME280_MAX_DEVICES] = { BME280_SENSOR_ADDR };
+static int num_addr = 0;
+module_param_array(addr, ushort, &num_addr, 0444);
+MODULE_PARM_DESC(addr, "I2C address of each sensor, 0x76 or 0x77 (default 0x77)");
+
+static struct bme280_dev *bme280_devices[BME280_MAX_DEVICES];
+static int bme280_num_devices = 0;
+
+// 0 keeps the sensor asleep and forces a conversion on every read. Anything
+// else runs it in normal mode and buffers samples for readers.
+static unsigned int standby_ms = 0;
+module_param(standby_ms, uint, 0444);
+MODULE_PARM_DESC(standby_ms, "Normal mode standby time between samples in ms (0 = forced mode)");
+
+// Standby time in us for each t_sb setting in config[7:5]
+static const unsigned int bme280_standby_us[] = { 500, 62500, 125000, 250000, 500000, 1000000, 10000, 20000 };
 
 // Define and initialize the i2c_driver struct
 static struct i2c_driver bme280_i2c_driver = 
@@ -64,8 +107,8 @@ static struct i2c_driver bme280_i2c_driver =
 };
 
 
-// Initialize I2C board info for BME280 device
-struct i2c_board_info bme280_i2c_board = 
+// Initialize I2C board info for BME280 device, the address is set per sensor
+static const struct i2c_board_info bme280_i2c_board = 
 {
     .type = "bme280",               // Set device type to "bme280"
     .addr = BME280_SENSOR_ADDR,     // Set I2C address of the BME280 device
@@ -77,12 +120,19 @@ struct i2c_board_info bme280_i2c_board =
 // Function to open the device
 int bme280_open(struct inode *inode, struct file *filp)
 {
-    struct bme280_dev* dev;
+    struct bme280_file *file;
     PDEBUG("open");
 
-    dev = container_of(inode -> i_cdev, struct bme280_dev, cdev);
+    file = kmalloc(sizeof(*file), GFP_KERNEL);
+    if(file == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    file -> dev = container_of(inode -> i_cdev, struct bme280_dev, cdev);
+    file -> read_mode = BME280_READ_TEXT;
 
-    filp -> private_data = dev;
+    filp -> private_data = file;
 
     return 0;
 }
@@ -92,148 +142,405 @@ int bme280_open(struct inode *inode, struct file *filp)
 int bme280_release(struct inode *inode, struct file *filp)
 {
     PDEBUG("release");
+    kfree(filp -> private_data);
     return 0;
 }
 
 
 // Each measurement - temperature, pressure and humidity, requires certain calibration data already present in the registers
-static void get_calibration_data(void)
+static int get_calibration_data(struct bme280_dev *dev)
 {
+    struct bme280_calib *calib = &dev -> calib;
+    uint8_t *calib_data = dev -> calib_raw.tp;
     int ret_val = 0;
 
-    // Read preset calibration data
-    ret_val = i2c_smbus_read_i2c_block_data(bme280_device.bme280_i2c_client, CALIB_ADDR, CALIB_DATA_PT_LEN, &bme280_device.calib_data[0]);
-    if(ret_val != CALIB_DATA_PT_LEN)
+    // Read preset calibration data. The humidity part is only kept for
+    // userspace, the driver does not compensate humidity.
+    ret_val = i2c_smbus_read_i2c_block_data(dev -> bme280_i2c_client, CALIB_ADDR, BME280_CALIB_TP_LEN, calib_data);
+    if(ret_val != BME280_CALIB_TP_LEN)
     {
         printk(KERN_ERR "Error reading calib data = %d\n", ret_val);
+        return -EIO;
     }
+    ret_val = i2c_smbus_read_i2c_block_data(dev -> bme280_i2c_client, CALIB_H_ADDR, BME280_CALIB_H_LEN, dev -> calib_raw.h);
+    if(ret_val != BME280_CALIB_H_LEN)
+    {
+        printk(KERN_ERR "Error reading humidity calib data = %d\n", ret_val);
+        return -EIO;
+    }
+
+    // Each coefficient is a little endian 16 bit word
+    // Reference: GitHub repo of Bosch Sensortec
+    calib -> dig_T1 = get_unaligned_le16(&calib_data[dig_T1 << 1]);
+    calib -> dig_T2 = (s16)get_unaligned_le16(&calib_data[dig_T2 << 1]);
+    calib -> dig_T3 = (s16)get_unaligned_le16(&calib_data[dig_T3 << 1]);
+    calib -> dig_P1 = get_unaligned_le16(&calib_data[dig_P1 << 1]);
+    calib -> dig_P2 = (s16)get_unaligned_le16(&calib_data[dig_P2 << 1]);
+    calib -> dig_P3 = (s16)get_unaligned_le16(&calib_data[dig_P3 << 1]);
+    calib -> dig_P4 = (s16)get_unaligned_le16(&calib_data[dig_P4 << 1]);
+    calib -> dig_P5 = (s16)get_unaligned_le16(&calib_data[dig_P5 << 1]);
+    calib -> dig_P6 = (s16)get_unaligned_le16(&calib_data[dig_P6 << 1]);
+    calib -> dig_P7 = (s16)get_unaligned_le16(&calib_data[dig_P7 << 1]);
+    calib -> dig_P8 = (s16)get_unaligned_le16(&calib_data[dig_P8 << 1]);
+    calib -> dig_P9 = (s16)get_unaligned_le16(&calib_data[dig_P9 << 1]);
+
+    // Terms of the datasheet formulas that don't depend on the reading
+    bme280_calib_derive(calib);
+
+    return 0;
 }
 
-// Read the pressure
-static long unsigned int bme280_pressure_read(void)
+// Oversampling register setting to number of samples: skipped, x1, x2, x4, x8, x16
+static unsigned int bme280_osrs_count(uint8_t osrs)
 {
-    long long signed int var1, var2, P;
-    long signed int adc_P = 0;
-    unsigned short dig_P1_val;
-    signed short dig_P2_val, dig_P3_val, dig_P4_val, dig_P5_val, dig_P6_val, dig_P7_val, dig_P8_val, dig_P9_val;
+    return (osrs == 0) ? 0 : (1 << (min_t(uint8_t, osrs, 5) - 1));
+}
 
-    // pres_msb - [19:12], pres_lsb - [11:4], pres_xlsb, [3:0]
-    adc_P |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, PRESSURE_REG_ADDR) << 12);
-    adc_P |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, PRESSURE_REG_ADDR + 1) << 4);
-    adc_P |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, PRESSURE_REG_ADDR + 2) >> 4);
+// Maximum conversion time in us for the configured oversampling
+// Reference: BME280 datasheet, appendix B (measurement time)
+static unsigned int bme280_measure_time_us(struct bme280_dev *dev)
+{
+    unsigned int osrs_t = bme280_osrs_count((dev -> ctrl_meas >> OSRS_T_LSB) & OSRS_MASK);
+    unsigned int osrs_p = bme280_osrs_count((dev -> ctrl_meas >> OSRS_P_LSB) & OSRS_MASK);
+    unsigned int osrs_h = bme280_osrs_count(dev -> ctrl_hum & OSRS_MASK);
+    unsigned int time_us = 1250 + 2300 * osrs_t;
 
-    // Concatenate bytes read from calibration registers to get calibration digits
-    // Reference: GitHub repo of Bosch Sensortec
-    dig_P1_val = (((bme280_device.calib_data[(dig_P1 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P1 << 1)]));
-    dig_P2_val = (((bme280_device.calib_data[(dig_P2 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P2 << 1)]));
-    dig_P3_val = (((bme280_device.calib_data[(dig_P3 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P3 << 1)]));
-    dig_P4_val = (((bme280_device.calib_data[(dig_P4 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P4 << 1)]));
-    dig_P5_val = (((bme280_device.calib_data[(dig_P5 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P5 << 1)]));
-    dig_P6_val = (((bme280_device.calib_data[(dig_P6 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P6 << 1)]));
-    dig_P7_val = (((bme280_device.calib_data[(dig_P7 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P7 << 1)]));
-    dig_P8_val = (((bme280_device.calib_data[(dig_P8 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P8 << 1)]));
-    dig_P9_val = (((bme280_device.calib_data[(dig_P9 << 1) + 1]) << 8) | (bme280_device.calib_data[(dig_P9 << 1)]));
-
-
-    // Reference: BME280 datasheet
-    var1 = ((long long signed int)tFine) - P_CALC;
-    var2 = var1 * var1 * ((long long signed int)dig_P6_val);
-    var2 = var2 + ((var1 * (long long signed int)dig_P5_val) << 17);
-    var2 = var2 + (((long long signed int)dig_P4_val) << 35);
-    var1 = ((var1 * var1 * (long long signed int)dig_P3_val) >> 8) + ((var1 * (long long signed int)dig_P2_val) << 12);
-    var1 = (((((long long signed int)1) << 47) + var1)) * ((long long signed int)dig_P1_val) >> 33;
-
-    // Check for zero before dividing
-    if (var1 == 0)
-    {
-        printk(KERN_ERR "Value of tFine = %lu and var1 = %lld", tFine, var1);
-        return -1;
+    if(osrs_p)
+    {
+        time_us += 2300 * osrs_p + 575;
     }
-    
-    P = P_CALC_2 - adc_P;
-    P = (((P << 31) - var2) * 3125);
-    do_div(P, var1);
-    var1 = (((long long signed int)dig_P9_val) * (P >> 13) * (P >> 13)) >> 25;
-    var2 = (((long long signed int)dig_P8_val) * P) >> 19;
-    P = ((P + var1 + var2) >> 8) + (((long long signed int)dig_P7_val) << 4);
+    if(osrs_h)
+    {
+        time_us += 2300 * osrs_h + 575;
+    }
+    return time_us;
+}
 
-    return (long unsigned int)P;
+// Sleep through the conversion, then confirm it finished with a bounded
+// number of status reads. Returns the time waited in us.
+static int bme280_wait_measurement(struct bme280_dev *dev)
+{
+    unsigned int time_us = bme280_measure_time_us(dev);
+    ktime_t start = ktime_get();
+    int status;
+    int poll;
 
-}
+    usleep_range(time_us, time_us + STATUS_POLL_US);
 
+    for(poll = 0; poll < STATUS_POLL_MAX; poll++)
+    {
+        status = i2c_smbus_read_byte_data(dev -> bme280_i2c_client, BME280_STATUS_REG_ADDR);
+        if(status < 0)
+        {
+            return status;
+        }
+        if(!(status & STATUS_MEASURING))
+        {
+            return ktime_us_delta(ktime_get(), start);
+        }
+        usleep_range(STATUS_POLL_US, 2 * STATUS_POLL_US);
+    }
 
-static long signed int bme280_temp_read(void)
-{
-    long signed int adc_T = 0, var1, var2, T;
-    unsigned short dig_T1_val;
-    signed short dig_T2_val, dig_T3_val;
-
-    // temp_msb - [19:12], temp_lsb - [11:4], temp_xlsb, [3:0]
-    adc_T |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, TEMP_REG_ADDR) << 12);
-    adc_T |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, TEMP_REG_ADDR + 1) << 4);
-    adc_T |= (i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, TEMP_REG_ADDR + 2) >> 4);
-
-    dig_T1_val = (((bme280_device.calib_data[dig_T1 + 1]) << 8) | (bme280_device.calib_data[dig_T1]));
-    dig_T2_val = (((bme280_device.calib_data[(1 << dig_T2) + 1]) << 8) | (bme280_device.calib_data[(1 << dig_T2)]));
-    dig_T3_val = (((bme280_device.calib_data[(1 << dig_T3) + 1]) << 8) | (bme280_device.calib_data[(1 << dig_T3)]));
-
-    // Compensation for possible errors in sensor data
-    // Reference for logic: BME280 Datasheet
-    var1 = (((adc_T >> 3) - ((long signed int) dig_T1_val << 1)) * ((long signed int) dig_T2_val)) >> 11;
-    var2 = (((((adc_T >> 4) - ((long signed int) dig_T1_val)) * ((adc_T >> 4) - ((long signed int) dig_T1_val))) >> 12) *
-        ((long signed int) dig_T3_val)) >> 14;
-
-    tFine = var1 + var2;
-
-    printk(KERN_DEBUG "Value of tFine = %ld\n", tFine);
-    T = (tFine * 5 + 128) >> 8;
-    return T;
+    printk(KERN_ERR "Measurement still in progress after %lld us\n", ktime_us_delta(ktime_get(), start));
+    return -ETIMEDOUT;
 }
 
 
-// Read the values from the sensor for temperature and pressure
-ssize_t bme280_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+// Read the latest conversion out of the data registers and fill in a
+// sample. Called with the device lock held.
+static int bme280_read_sample(struct bme280_dev *dev, struct bme280_sample *sample)
 {
+    long signed int adc_T, adc_P;
     long signed int bme280_temperature_val;
     long unsigned int bme280_pressure_val;
-    ssize_t num_bytes_read = MEASUREMENT_LEN;
-    ssize_t retval = 0;
-    int rmw_val;
-    char measurements[MEASUREMENT_LEN];
+    uint8_t data[DATA_REG_LEN];
+    s32 t_fine;
+    int retval;
+
+    // Fetch pressure, temperature and humidity in one transfer. The sensor
+    // shadows the data registers during a burst read, so T and P are
+    // guaranteed to come from the same conversion.
+    retval = i2c_smbus_read_i2c_block_data(dev -> bme280_i2c_client, DATA_REG_ADDR, DATA_REG_LEN, data);
+    if(retval != DATA_REG_LEN)
+    {
+        printk(KERN_ERR "Coudn't read measurement registers. Result = %d\n", retval);
+        return (retval < 0) ? retval : -EIO;
+    }
+
+    adc_P = bme280_adc20(&data[PRESSURE_DATA_OFFSET]);
+    adc_T = bme280_adc20(&data[TEMP_DATA_OFFSET]);
+
+    bme280_temperature_val = bme280_temp_compensate(&dev -> calib, adc_T, &t_fine);
 
-    // Force a reading
-    rmw_val = i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR);
-    retval = i2c_smbus_write_byte_data(bme280_device.bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, (rmw_val | (1 << MODE_LSB)));
+
+    // Compensate Pressure value
+    bme280_pressure_val = bme280_pressure_compensate(&dev -> calib, adc_P, t_fine);
+    if(bme280_pressure_val == -1)
+    {
+        printk(KERN_ERR "Coudn't read pressure value, t_fine = %d\n", t_fine);
+        return -EIO;
+    }
+
+    memset(sample, 0, sizeof(*sample));
+    sample -> timestamp_ns = ktime_get_real_ns();
+    sample -> sequence = ++dev -> sequence;
+    sample -> adc_T = adc_T;
+    sample -> adc_P = adc_P;
+    sample -> adc_H = (data[HUM_DATA_OFFSET] << 8) | data[HUM_DATA_OFFSET + 1];
+    sample -> temperature = bme280_temperature_val;
+    sample -> pressure = bme280_pressure_val;
+
+    return 0;
+}
+
+
+// Publish a sample to the mmap ring. Called with the device lock held, so
+// there is only ever one writer. The index lives in the device, the mapped
+// copy is never read back.
+static void bme280_ring_publish(struct bme280_dev *dev, const struct bme280_sample *sample)
+{
+    struct bme280_ring *ring = dev -> ring;
+    u32 head = dev -> ring_head;
+
+    // Announce the overwrite before the slot changes, so a reader that sees
+    // any part of the new sample also sees the sequence that reveals it
+    WRITE_ONCE(ring -> write_seq, head + 1);
+    smp_wmb();
+    ring -> samples[head & (BME280_RING_SAMPLES - 1)] = *sample;
+
+    dev -> ring_head = head + 1;
+    // The sample must be visible before the new head
+    smp_store_release(&ring -> head, dev -> ring_head);
+}
+
+
+// Force a measurement and fill in a sample. The device lock keeps concurrent
+// callers from interleaving the force/wait/read sequence on the bus.
+static int bme280_take_sample(struct bme280_dev *dev, struct bme280_sample *sample)
+{
+    int wait_us;
+    int retval = 0;
+
+    if(mutex_lock_interruptible(&dev -> lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    // Force a reading. ctrl_meas is cached, so this is a single write.
+    retval = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, (dev -> ctrl_meas | (1 << MODE_LSB)));
 
     if(retval < 0)
     {
-        printk(KERN_ERR "Coudn't write data to force reading Result = %ld\n", retval);
-        return -1;
+        printk(KERN_ERR "Coudn't write data to force reading Result = %d\n", retval);
+        goto exit_unlock;
     }
 
-    // Wait while a measurement is in progress
-    while(!(i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, BME280_STATUS_REG_ADDR) & MEASUREMENT_IN_PROGRESS));
+    // Wait for the conversion without spinning on the bus
+    wait_us = bme280_wait_measurement(dev);
+    if(wait_us < 0)
+    {
+        retval = wait_us;
+        goto exit_unlock;
+    }
+    PDEBUG("Conversion took %d us\n", wait_us);
 
-    bme280_temperature_val = bme280_temp_read();
+    retval = bme280_read_sample(dev, sample);
+    if(retval == 0)
+    {
+        sample -> wait_us = wait_us;
+        bme280_ring_publish(dev, sample);
+    }
 
+exit_unlock:
+    mutex_unlock(&dev -> lock);
+    return retval;
+}
 
-    // Read Pressure value
-    bme280_pressure_val = bme280_pressure_read();
-    if(bme280_pressure_val == -1)
+
+// Normal mode: the sensor converts on its own every period_us, and this work
+// item copies each result into the FIFO. It is the only producer, so the
+// FIFO needs no lock on this side. When readers fall behind, new samples
+// are dropped and show up as gaps in the sequence numbers.
+static void bme280_sample_work(struct work_struct *work)
+{
+    struct bme280_dev *dev = container_of(to_delayed_work(work), struct bme280_dev, sample_work);
+    struct bme280_sample sample;
+    int retval;
+
+    mutex_lock(&dev -> lock);
+    retval = bme280_read_sample(dev, &sample);
+    if(retval == 0)
+    {
+        bme280_ring_publish(dev, &sample);
+    }
+    mutex_unlock(&dev -> lock);
+
+    if(retval == 0)
+    {
+        if(!kfifo_put(&dev -> fifo, sample))
+        {
+            dev -> overruns++;
+        }
+        wake_up_interruptible(&dev -> read_wait);
+    }
+
+    // Schedule against the ideal timeline so the period does not drift
+    dev -> next_sample += usecs_to_jiffies(dev -> period_us);
+    if(time_before_eq(dev -> next_sample, jiffies))
+    {
+        dev -> next_sample = jiffies + 1;
+    }
+    schedule_delayed_work(&dev -> sample_work, dev -> next_sample - jiffies);
+}
+
+
+// Wait until the FIFO holds a sample. Returns 0 with read_lock held, or
+// BME280_FIFO_STOPPED without it once normal mode has ended and the FIFO is
+// drained, so the caller takes a forced measurement instead.
+static int bme280_wait_fifo(struct bme280_dev *dev, struct file *filp)
+{
+    if(mutex_lock_interruptible(&dev -> read_lock))
     {
-        printk(KERN_ERR "Coudn't read pressure value. Error = %ld\n", bme280_pressure_val);
-        return 0;
+        return -ERESTARTSYS;
     }
 
-    snprintf(measurements, sizeof(measurements), "%ld %lu", bme280_temperature_val, bme280_pressure_val);
+    while(kfifo_is_empty(&dev -> fifo))
+    {
+        mutex_unlock(&dev -> read_lock);
+        if(!dev -> normal_mode)
+        {
+            return BME280_FIFO_STOPPED;
+        }
+        if(filp -> f_flags & O_NONBLOCK)
+        {
+            return -EAGAIN;
+        }
+        if(wait_event_interruptible(dev -> read_wait, !kfifo_is_empty(&dev -> fifo) || !dev -> normal_mode))
+        {
+            return -ERESTARTSYS;
+        }
+        if(mutex_lock_interruptible(&dev -> read_lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+    return 0;
+}
+
+
+// Next sample for this reader: a fresh forced measurement, or in normal mode
+// the oldest buffered one
+static int bme280_next_sample(struct bme280_dev *dev, struct file *filp, struct bme280_sample *sample)
+{
+    int retval;
+
+    if(!dev -> normal_mode)
+    {
+        return bme280_take_sample(dev, sample);
+    }
+
+    retval = bme280_wait_fifo(dev, filp);
+    if(retval == BME280_FIFO_STOPPED)
+    {
+        return bme280_take_sample(dev, sample);
+    }
+    if(retval < 0)
+    {
+        return retval;
+    }
+    retval = kfifo_get(&dev -> fifo, sample) ? 0 : -EAGAIN;
+    mutex_unlock(&dev -> read_lock);
+    return retval;
+}
+
+
+// Normal mode binary read: drain as many whole samples as fit in the buffer
+static ssize_t bme280_read_fifo(struct bme280_dev *dev, struct file *filp, char __user *buf, size_t count)
+{
+    struct bme280_sample sample;
+    unsigned int copied;
+    ssize_t retval;
 
+    retval = bme280_wait_fifo(dev, filp);
+    if(retval == BME280_FIFO_STOPPED)
+    {
+        // Normal mode ended while waiting, hand back one forced measurement
+        retval = bme280_take_sample(dev, &sample);
+        if(retval == 0)
+        {
+            retval = copy_to_user(buf, &sample, sizeof(sample)) ? -EFAULT : sizeof(sample);
+        }
+        return retval;
+    }
+    if(retval < 0)
+    {
+        return retval;
+    }
 
-    // Copy the entry from the specified offset to the user-provided buffer
-    if(copy_to_user(buf, measurements, MEASUREMENT_LEN))
+    count -= count % sizeof(struct bme280_sample);
+    if(kfifo_to_user(&dev -> fifo, buf, count, &copied))
     {
         retval = -EFAULT;
-        goto exit_gracefully;
+    }
+    else
+    {
+        retval = copied;
+    }
+    mutex_unlock(&dev -> read_lock);
+
+    PDEBUG("Number of bytes read = %ld\n", retval);
+    return retval;
+}
+
+
+// Read the values from the sensor for temperature and pressure, either as
+// text for cat or as a struct bme280_sample
+ssize_t bme280_read(struct file *filp, char __user *buf, size_t count,
+                loff_t *f_pos)
+{
+    struct bme280_file *file = filp -> private_data;
+    struct bme280_sample sample;
+    ssize_t num_bytes_read;
+    ssize_t retval = 0;
+    char measurements[MEASUREMENT_LEN];
+
+    if((file -> read_mode == BME280_READ_BINARY) && (count < sizeof(sample)))
+    {
+        return -EINVAL;
+    }
+
+    if((file -> read_mode == BME280_READ_BINARY) && file -> dev -> normal_mode)
+    {
+        return bme280_read_fifo(file -> dev, filp, buf, count);
+    }
+
+    retval = bme280_next_sample(file -> dev, filp, &sample);
+    if(retval < 0)
+    {
+        return retval;
+    }
+
+    if(file -> read_mode == BME280_READ_BINARY)
+    {
+        // Copy the sample as is, no formatting
+        num_bytes_read = sizeof(sample);
+        if(copy_to_user(buf, &sample, num_bytes_read))
+        {
+            retval = -EFAULT;
+            goto exit_gracefully;
+        }
+    }
+    else
+    {
+        snprintf(measurements, sizeof(measurements), "%d %u", sample.temperature, sample.pressure);
+
+        // Copy the string and its NUL, never the unused rest of the buffer
+        num_bytes_read = min_t(size_t, count, strlen(measurements) + 1);
+        if(copy_to_user(buf, measurements, num_bytes_read))
+        {
+            retval = -EFAULT;
+            goto exit_gracefully;
+        }
     }
 
     PDEBUG("Number of bytes read = %ld\n", num_bytes_read);
@@ -246,17 +553,299 @@ exit_gracefully:
 }
 
 
+// Readable whenever a read would not block: always in forced mode, and in
+// normal mode once the FIFO holds a sample
+__poll_t bme280_poll(struct file *filp, poll_table *wait)
+{
+    struct bme280_file *file = filp -> private_data;
+    struct bme280_dev *dev = file -> dev;
+
+    poll_wait(filp, &dev -> read_wait, wait);
+
+    if(!dev -> normal_mode || !kfifo_is_empty(&dev -> fifo))
+    {
+        return EPOLLIN | EPOLLRDNORM;
+    }
+    return 0;
+}
+
+
+// Longest supported standby time that does not exceed the requested one
+static uint8_t bme280_standby_setting(unsigned int requested_us)
+{
+    uint8_t best = 0;
+    uint8_t t_sb;
+
+    for(t_sb = 0; t_sb < ARRAY_SIZE(bme280_standby_us); t_sb++)
+    {
+        if((bme280_standby_us[t_sb] <= requested_us) && (bme280_standby_us[t_sb] > bme280_standby_us[best]))
+        {
+            best = t_sb;
+        }
+    }
+    return best;
+}
+
+
+// Let the sensor convert continuously and start filling the FIFO. The
+// sensor must be asleep, since config writes are ignored in normal mode.
+static int bme280_start_normal_mode(struct bme280_dev *dev, unsigned int requested_us)
+{
+    uint8_t t_sb = bme280_standby_setting(requested_us);
+    int result;
+
+    mutex_lock(&dev -> lock);
+
+    result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CONFIG_REG_ADDR, (t_sb << STANDBY_LSB) | (dev -> filter << FILTER_LSB));
+    if(result < 0)
+    {
+        printk(KERN_ERR "Coudn't write standby time. Result = %d\n", result);
+        goto exit_unlock;
+    }
+
+    result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, dev -> ctrl_meas | MODE_NORMAL);
+    if(result < 0)
+    {
+        printk(KERN_ERR "Coudn't enter normal mode. Result = %d\n", result);
+        goto exit_unlock;
+    }
+
+    dev -> standby_us = bme280_standby_us[t_sb];
+    dev -> period_us = bme280_measure_time_us(dev) + dev -> standby_us;
+    dev -> next_sample = jiffies + usecs_to_jiffies(dev -> period_us);
+    dev -> normal_mode = true;
+    schedule_delayed_work(&dev -> sample_work, usecs_to_jiffies(dev -> period_us));
+
+    printk(KERN_INFO "bme280: normal mode, one sample every %u us\n", dev -> period_us);
+
+exit_unlock:
+    mutex_unlock(&dev -> lock);
+    return result;
+}
+
+
+// Stop sampling and put the sensor back to sleep. Blocked readers wake up
+// and fall back to forced measurements.
+static void bme280_stop_normal_mode(struct bme280_dev *dev)
+{
+    if(!dev -> normal_mode)
+    {
+        return;
+    }
+
+    dev -> normal_mode = false;
+    cancel_delayed_work_sync(&dev -> sample_work);
+    wake_up_interruptible(&dev -> read_wait);
+
+    mutex_lock(&dev -> lock);
+    i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, dev -> ctrl_meas);
+    mutex_unlock(&dev -> lock);
+}
+
+
+static void bme280_get_config(struct bme280_dev *dev, struct bme280_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg -> osrs_t = (dev -> ctrl_meas >> OSRS_T_LSB) & OSRS_MASK;
+    cfg -> osrs_p = (dev -> ctrl_meas >> OSRS_P_LSB) & OSRS_MASK;
+    cfg -> osrs_h = dev -> ctrl_hum & OSRS_MASK;
+    cfg -> filter = dev -> filter;
+    cfg -> standby_us = dev -> normal_mode ? dev -> standby_us : 0;
+    cfg -> measure_time_us = bme280_measure_time_us(dev);
+    cfg -> period_us = dev -> normal_mode ? dev -> period_us : 0;
+}
+
+
+// Apply new oversampling, filter and standby settings. The sensor only
+// accepts config writes in sleep mode, so normal mode is stopped first and
+// restarted with the new timing.
+static int bme280_set_config(struct bme280_dev *dev, struct bme280_config *cfg)
+{
+    uint8_t ctrl_meas;
+    int result;
+
+    // Temperature and pressure are always reported, so neither may be skipped
+    if((cfg -> osrs_t < 1) || (cfg -> osrs_t > BME280_OSRS_MAX) ||
+       (cfg -> osrs_p < 1) || (cfg -> osrs_p > BME280_OSRS_MAX) ||
+       (cfg -> osrs_h > BME280_OSRS_MAX) || (cfg -> filter > BME280_FILTER_MAX))
+    {
+        return -EINVAL;
+    }
+    if((cfg -> standby_us != 0) && (cfg -> standby_us < bme280_standby_us[0]))
+    {
+        return -EINVAL;
+    }
+
+    if(mutex_lock_interruptible(&dev -> config_lock))
+    {
+        return -ERESTARTSYS;
+    }
+
+    bme280_stop_normal_mode(dev);
+
+    mutex_lock(&dev -> lock);
+    ctrl_meas = (cfg -> osrs_t << OSRS_T_LSB) | (cfg -> osrs_p << OSRS_P_LSB);
+
+    // ctrl_hum only takes effect after the following ctrl_meas write
+    result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_HUM_REG_ADDR, cfg -> osrs_h);
+    if(result == 0)
+    {
+        result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CONFIG_REG_ADDR, cfg -> filter << FILTER_LSB);
+    }
+    if(result == 0)
+    {
+        result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, ctrl_meas);
+    }
+    if(result == 0)
+    {
+        dev -> ctrl_hum = cfg -> osrs_h;
+        dev -> filter = cfg -> filter;
+        dev -> ctrl_meas = ctrl_meas;
+    }
+    else
+    {
+        printk(KERN_ERR "Coudn't write sensor configuration. Result = %d\n", result);
+    }
+    mutex_unlock(&dev -> lock);
+
+    if((result == 0) && (cfg -> standby_us != 0))
+    {
+        result = bme280_start_normal_mode(dev, cfg -> standby_us);
+    }
+
+    bme280_get_config(dev, cfg);
+    PDEBUG("Conversion time is now %u us\n", cfg -> measure_time_us);
+
+    mutex_unlock(&dev -> config_lock);
+    return result;
+}
+
+
+// Map the sample ring into the caller. The mapping must start at offset 0,
+// may not be larger than the ring and is read-only, so no opener can change
+// what the other consumers see.
+int bme280_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct bme280_file *file = filp -> private_data;
+
+    if(vma -> vm_pgoff != 0)
+    {
+        return -EINVAL;
+    }
+    if((vma -> vm_end - vma -> vm_start) > PAGE_ALIGN(sizeof(struct bme280_ring)))
+    {
+        return -EINVAL;
+    }
+    if(vma -> vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma -> vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_vmalloc_range(vma, file -> dev -> ring, 0);
+}
+
+
+long bme280_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct bme280_file *file = filp -> private_data;
+    struct bme280_sample sample;
+    struct bme280_config config;
+    long retval = 0;
+    int mode;
+
+    if((_IOC_TYPE(cmd) != BME280_IOC_MAGIC) || (_IOC_NR(cmd) > BME280_IOC_MAXNR))
+    {
+        return -ENOTTY;
+    }
+
+    switch(cmd)
+    {
+    case BME280_IOCGSAMPLE:
+        retval = bme280_next_sample(file -> dev, filp, &sample);
+        if(retval == 0 && copy_to_user((void __user *)arg, &sample, sizeof(sample)))
+        {
+            retval = -EFAULT;
+        }
+        break;
+
+    case BME280_IOCSMODE:
+        if(get_user(mode, (int __user *)arg))
+        {
+            retval = -EFAULT;
+            break;
+        }
+        if((mode != BME280_READ_TEXT) && (mode != BME280_READ_BINARY))
+        {
+            retval = -EINVAL;
+            break;
+        }
+        file -> read_mode = mode;
+        break;
+
+    case BME280_IOCGCONFIG:
+        if(mutex_lock_interruptible(&file -> dev -> config_lock))
+        {
+            retval = -ERESTARTSYS;
+            break;
+        }
+        bme280_get_config(file -> dev, &config);
+        mutex_unlock(&file -> dev -> config_lock);
+        if(copy_to_user((void __user *)arg, &config, sizeof(config)))
+        {
+            retval = -EFAULT;
+        }
+        break;
+
+    case BME280_IOCGCALIB:
+        if(copy_to_user((void __user *)arg, &file -> dev -> calib_raw, sizeof(file -> dev -> calib_raw)))
+        {
+            retval = -EFAULT;
+        }
+        break;
+
+    case BME280_IOCSCONFIG:
+        if(copy_from_user(&config, (void __user *)arg, sizeof(config)))
+        {
+            retval = -EFAULT;
+            break;
+        }
+        retval = bme280_set_config(file -> dev, &config);
+        // Report what is in effect, even if applying failed part way
+        if(copy_to_user((void __user *)arg, &config, sizeof(config)))
+        {
+            retval = -EFAULT;
+        }
+        break;
+
+    default:
+        retval = -ENOTTY;
+        break;
+    }
+
+    return retval;
+}
+
+
 struct file_operations bme280_fops = {
     .owner =            THIS_MODULE,
     .read =             bme280_read,
+    .unlocked_ioctl =   bme280_ioctl,
+    .compat_ioctl =     compat_ptr_ioctl,
+    .poll =             bme280_poll,
+    .mmap =             bme280_mmap,
     .open =             bme280_open,
     .release =          bme280_release,
 };
 
 
-static int bme280_setup_cdev(struct bme280_dev *dev)
+static int bme280_setup_cdev(struct bme280_dev *dev, int index)
 {
-    int err, devno = MKDEV(bme280_major, bme280_minor);
+    int err, devno = MKDEV(bme280_major, bme280_minor + index);
 
     cdev_init(&dev->cdev, &bme280_fops);
     dev -> cdev.owner = THIS_MODULE;
@@ -269,13 +858,13 @@ static int bme280_setup_cdev(struct bme280_dev *dev)
 }
 
 
-static uint8_t bme280_init_sensor(void)
+static int bme280_init_sensor(struct bme280_dev *dev)
 {
     int retval = 0;
     int result = 0;
     uint8_t rmw_val = 0;
 
-    int8_t chip_id = i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, BME280_CHIP_ID_REG_ADDR);
+    int8_t chip_id = i2c_smbus_read_byte_data(dev -> bme280_i2c_client, BME280_CHIP_ID_REG_ADDR);
 
     if(chip_id != BME280_CHIP_ID)
     {
@@ -286,8 +875,8 @@ static uint8_t bme280_init_sensor(void)
 
     // Table 7 in datasheet (suggested settings for weather monitoring)
     // turn off IIR filter
-    rmw_val = i2c_smbus_read_byte_data(bme280_device.bme280_i2c_client, BME280_CONFIG_REG_ADDR);
-    result = i2c_smbus_write_byte_data(bme280_device.bme280_i2c_client, BME280_CONFIG_REG_ADDR, (rmw_val & ~IIR_FILTER_BIT_MASK));
+    rmw_val = i2c_smbus_read_byte_data(dev -> bme280_i2c_client, BME280_CONFIG_REG_ADDR);
+    result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CONFIG_REG_ADDR, (rmw_val & ~IIR_FILTER_BIT_MASK));
     if(result < 0)
     {
         printk(KERN_ERR "Coudn't write data to turn off IIR filter. Result = %d\n", result);
@@ -301,8 +890,9 @@ static uint8_t bme280_init_sensor(void)
     // Mode = SLEEP initially
     rmw_val = 0;
     rmw_val |= ((1 << OSRS_T_LSB) | (1 << OSRS_P_LSB));
-    rmw_val &= ~SLEEP_MASK;
-    result = i2c_smbus_write_byte_data(bme280_device.bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, rmw_val);
+    rmw_val &= SLEEP_MASK;     // Clear mode[1:0] only, keeping osrs_t and osrs_p
+    result = i2c_smbus_write_byte_data(dev -> bme280_i2c_client, BME280_CTRL_MEAS_REG_ADDR, rmw_val);
+    dev -> ctrl_meas = rmw_val;
 
     if(result < 0)
     {
@@ -312,44 +902,135 @@ static uint8_t bme280_init_sensor(void)
     }
     
 
-    // Get calibration data from NVM
-    get_calibration_data();
+    // Get calibration data from NVM and decode it once
+    if(get_calibration_data(dev) < 0)
+    {
+        retval = -1;
+    }
 
 exit_sensor_init:
     return retval;
 }
 
 
-int bme280_init_module(void)
+// Set up one sensor: its state, the I2C client on the given adapter and
+// address, the sensor registers, and finally its char device
+static struct bme280_dev *bme280_create_device(int index, int bus_nr, unsigned short address)
 {
-    dev_t dev = 0;
+    struct i2c_board_info board = bme280_i2c_board;
+    struct bme280_dev *dev;
     int result;
-    result = alloc_chrdev_region(&dev, bme280_minor, 1,
-            "bme280");
-    bme280_major = MAJOR(dev);
 
-    if (result < 0) {
-        printk(KERN_ERR "Can't get major %d\n", bme280_major);
-        return result;
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if(dev == NULL)
+    {
+        return ERR_PTR(-ENOMEM);
     }
-    
+
+    mutex_init(&dev -> lock);
+    mutex_init(&dev -> config_lock);
+    mutex_init(&dev -> read_lock);
+    init_waitqueue_head(&dev -> read_wait);
+    INIT_KFIFO(dev -> fifo);
+    INIT_DELAYED_WORK(&dev -> sample_work, bme280_sample_work);
+
+    // Zeroed and page aligned, so it can be handed to userspace as is
+    dev -> ring = vmalloc_user(sizeof(struct bme280_ring));
+    if(dev -> ring == NULL)
+    {
+        result = -ENOMEM;
+        goto free_dev;
+    }
+    dev -> ring -> size = BME280_RING_SAMPLES;
+    dev -> ring -> record_size = sizeof(struct bme280_sample);
+
     // Get the I2C adapter (master handle)
-    bme280_device.bme280_i2c_adapter = i2c_get_adapter(1); //todo: Check 
-    if(bme280_device.bme280_i2c_adapter == NULL)
+    dev -> bme280_i2c_adapter = i2c_get_adapter(bus_nr);
+    if(dev -> bme280_i2c_adapter == NULL)
     {
-        printk(KERN_ERR "Failed to get I2C adapter\n");
+        printk(KERN_ERR "Failed to get I2C adapter %d\n", bus_nr);
         result = -ENODEV;
-        goto safe_exit;
+        goto free_ring;
     }
 
+    // Create an I2C client structure. It holds its own adapter reference.
+    board.addr = address;
+    dev -> bme280_i2c_client = i2c_new_client_device(dev -> bme280_i2c_adapter, &board);
+    i2c_put_adapter(dev -> bme280_i2c_adapter);
+    if(IS_ERR_OR_NULL(dev -> bme280_i2c_client))
+    {
+        printk(KERN_ERR "Failed to register I2C device %d-%04x\n", bus_nr, address);
+        result = -ENODEV;
+        goto free_ring;
+    }
 
-    // Create an I2C client structure
-    bme280_device.bme280_i2c_client = i2c_new_client_device(bme280_device.bme280_i2c_adapter, &bme280_i2c_board);
-    if (bme280_device.bme280_i2c_client == NULL) 
+    // Intialize the registers of the sensor
+    if(bme280_init_sensor(dev) != 0)
     {
-        printk(KERN_ERR "Failed to register I2C device\n");
+        printk(KERN_ERR "No working BME280 at %d-%04x\n", bus_nr, address);
         result = -ENODEV;
-        goto safe_exit;
+        goto unregister_client;
+    }
+
+    if(standby_ms)
+    {
+        bme280_start_normal_mode(dev, standby_ms * 1000);
+    }
+
+    result = bme280_setup_cdev(dev, index);
+    if(result)
+    {
+        bme280_stop_normal_mode(dev);
+        goto unregister_client;
+    }
+
+    PDEBUG("Sensor %d at %d-%04x initialized\n", index, bus_nr, address);
+    return dev;
+
+unregister_client:
+    i2c_unregister_device(dev -> bme280_i2c_client);
+free_ring:
+    vfree(dev -> ring);
+free_dev:
+    kfree(dev);
+    return ERR_PTR(result);
+}
+
+
+static void bme280_destroy_device(struct bme280_dev *dev)
+{
+    bme280_stop_normal_mode(dev);
+
+    cdev_del(&dev -> cdev);
+
+    // Remove the I2C client from the I2C subsystem 
+    i2c_unregister_device(dev -> bme280_i2c_client);
+
+    vfree(dev -> ring);
+    kfree(dev);
+}
+
+
+int bme280_init_module(void)
+{
+    dev_t dev = 0;
+    int num_devices = (num_addr > 0) ? num_addr : 1;
+    int result;
+    int i;
+
+    if((num_bus > 1) && (num_bus != num_devices))
+    {
+        printk(KERN_ERR "bus needs one entry, or one per addr entry\n");
+        return -EINVAL;
+    }
+
+    result = alloc_chrdev_region(&dev, bme280_minor, num_devices,
+            "bme280");
+    bme280_major = MAJOR(dev);
+
+    if (result < 0) {
+        printk(KERN_ERR "Can't get major %d\n", bme280_major);
+        return result;
     }
 
     result = i2c_add_driver(&bme280_i2c_driver);
@@ -360,24 +1041,30 @@ int bme280_init_module(void)
         goto safe_exit;
     }
 
-    result = bme280_setup_cdev(&bme280_device);
-
-    if(result) {
-        unregister_chrdev_region(dev, 1);
+    // Each sensor has its own lock, FIFO and worker, so they sample in parallel
+    for(i = 0; i < num_devices; i++)
+    {
+        struct bme280_dev *sensor = bme280_create_device(i, bus[(num_bus > 1) ? i : 0], addr[i]);
+
+        if(IS_ERR(sensor))
+        {
+            result = PTR_ERR(sensor);
+            goto destroy_devices;
+        }
+        bme280_devices[bme280_num_devices++] = sensor;
     }
 
-    // Intialize the registers of the sensor
-    bme280_init_sensor();
-    PDEBUG("Initialized\n");
-    goto only_exit;
+    PDEBUG("Initialized %d sensors\n", bme280_num_devices);
+    return 0;
 
-safe_exit:
-    unregister_chrdev_region(dev, 1);
-only_exit:
-    if (bme280_device.bme280_i2c_adapter != NULL)
+destroy_devices:
+    while(bme280_num_devices > 0)
     {
-        i2c_put_adapter(bme280_device.bme280_i2c_adapter);
+        bme280_destroy_device(bme280_devices[--bme280_num_devices]);
     }
+    i2c_del_driver(&bme280_i2c_driver);
+safe_exit:
+    unregister_chrdev_region(dev, num_devices);
     return result;
 
 }
@@ -386,20 +1073,21 @@ only_exit:
 void bme280_cleanup_module(void)
 {
     dev_t devno;
+    int num_devices = bme280_num_devices;
 
-    // Remove the I2C client from the I2C subsystem 
-    i2c_unregister_device(bme280_device.bme280_i2c_client);
+    while(bme280_num_devices > 0)
+    {
+        bme280_destroy_device(bme280_devices[--bme280_num_devices]);
+    }
 
     // Delete the driver 
     i2c_del_driver(&bme280_i2c_driver);
 
     devno = MKDEV(bme280_major, bme280_minor);
 
-    cdev_del(&bme280_device.cdev);
-
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, num_devices);
 }
 
 
 module_init(bme280_init_module);
-module_exit(bme280_cleanup_module);
\ No newline at end of file
+module_exit(bme280_cleanup_module);
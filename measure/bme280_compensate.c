@@ -0,0 +1,119 @@
+#include "bme280_compensate.h"
+
+// Offsets into struct bme280_calib_block, datasheet table 16
+#define CALIB_TP_H1 (25)    // 0xA1
+#define CALIB_H_H2 (0)      // 0xE1/0xE2
+#define CALIB_H_H3 (2)      // 0xE3
+#define CALIB_H_H4 (3)      // 0xE4/0xE5[3:0]
+#define CALIB_H_H5 (4)      // 0xE5[7:4]/0xE6
+#define CALIB_H_H6 (6)      // 0xE7
+
+static uint16_t le16(const uint8_t *data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+void bme280_calib_decode(const struct bme280_calib_block *raw, struct bme280_calib_params *params) {
+    const uint8_t *tp = raw->tp;
+    const uint8_t *h = raw->h;
+
+    params->dig_T1 = le16(&tp[0]);
+    params->dig_T2 = (int16_t)le16(&tp[2]);
+    params->dig_T3 = (int16_t)le16(&tp[4]);
+    params->dig_P1 = le16(&tp[6]);
+    params->dig_P2 = (int16_t)le16(&tp[8]);
+    params->dig_P3 = (int16_t)le16(&tp[10]);
+    params->dig_P4 = (int16_t)le16(&tp[12]);
+    params->dig_P5 = (int16_t)le16(&tp[14]);
+    params->dig_P6 = (int16_t)le16(&tp[16]);
+    params->dig_P7 = (int16_t)le16(&tp[18]);
+    params->dig_P8 = (int16_t)le16(&tp[20]);
+    params->dig_P9 = (int16_t)le16(&tp[22]);
+
+    params->dig_H1 = tp[CALIB_TP_H1];
+    params->dig_H2 = (int16_t)le16(&h[CALIB_H_H2]);
+    params->dig_H3 = h[CALIB_H_H3];
+    // H4 and H5 are 12-bit values sharing the nibbles of 0xE5
+    params->dig_H4 = (int16_t)(((int8_t)h[CALIB_H_H4] * 16) | (h[CALIB_H_H4 + 1] & 0x0F));
+    params->dig_H5 = (int16_t)(((int8_t)h[CALIB_H_H5 + 1] * 16) | (h[CALIB_H_H5] >> 4));
+    params->dig_H6 = (int8_t)h[CALIB_H_H6];
+}
+
+// Pure 32-bit arithmetic with no branches, so this loop vectorizes
+void bme280_compensate_temperature(const struct bme280_calib_params *params, const int32_t *restrict adc_T,
+                                   size_t count, int32_t *restrict temperature, int32_t *restrict t_fine) {
+    const int32_t t1 = params->dig_T1;
+    const int32_t t2 = params->dig_T2;
+    const int32_t t3 = params->dig_T3;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int32_t var1 = ((((adc_T[i] >> 3) - (t1 << 1))) * t2) >> 11;
+        int32_t var2 = (((((adc_T[i] >> 4) - t1) * ((adc_T[i] >> 4) - t1)) >> 12) * t3) >> 14;
+        int32_t fine = var1 + var2;
+
+        temperature[i] = (fine * 5 + 128) >> 8;
+        t_fine[i] = fine;
+    }
+}
+
+// The 64-bit division per sample keeps this loop scalar; the terms that
+// only depend on calibration are hoisted out of it
+void bme280_compensate_pressure(const struct bme280_calib_params *params, const int32_t *restrict adc_P,
+                                const int32_t *restrict t_fine, size_t count, uint32_t *restrict pressure) {
+    const int64_t p1 = params->dig_P1;
+    const int64_t p2 = params->dig_P2;
+    const int64_t p3 = params->dig_P3;
+    const int64_t p4_shifted = ((int64_t)params->dig_P4) << 35;
+    const int64_t p5 = params->dig_P5;
+    const int64_t p6 = params->dig_P6;
+    const int64_t p7_shifted = ((int64_t)params->dig_P7) << 4;
+    const int64_t p8 = params->dig_P8;
+    const int64_t p9 = params->dig_P9;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int64_t var1 = ((int64_t)t_fine[i]) - 128000;
+        int64_t var2 = var1 * var1 * p6;
+        int64_t p;
+
+        var2 = var2 + ((var1 * p5) << 17);
+        var2 = var2 + p4_shifted;
+        var1 = ((var1 * var1 * p3) >> 8) + ((var1 * p2) << 12);
+        var1 = (((((int64_t)1) << 47) + var1)) * p1 >> 33;
+
+        if (var1 == 0) {
+            pressure[i] = 0;
+            continue;
+        }
+
+        p = 1048576 - adc_P[i];
+        p = (((p << 31) - var2) * 3125) / var1;
+        var1 = (p9 * (p >> 13) * (p >> 13)) >> 25;
+        var2 = (p8 * p) >> 19;
+        p = ((p + var1 + var2) >> 8) + p7_shifted;
+        pressure[i] = (uint32_t)p;
+    }
+}
+
+// Clamping is written as selects rather than branches so this loop vectorizes
+void bme280_compensate_humidity(const struct bme280_calib_params *params, const int32_t *restrict adc_H,
+                                const int32_t *restrict t_fine, size_t count, uint32_t *restrict humidity) {
+    const int32_t h1 = params->dig_H1;
+    const int32_t h2 = params->dig_H2;
+    const int32_t h3 = params->dig_H3;
+    const int32_t h4_shifted = ((int32_t)params->dig_H4) * (1 << 20);
+    const int32_t h5 = params->dig_H5;
+    const int32_t h6 = params->dig_H6;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int32_t v = t_fine[i] - ((int32_t)76800);
+
+        v = (((((adc_H[i] << 14) - h4_shifted - (h5 * v)) + ((int32_t)16384)) >> 15) *
+             (((((((v * h6) >> 10) * (((v * h3) >> 11) + ((int32_t)32768))) >> 10) + ((int32_t)2097152)) * h2 + 8192) >> 14));
+        v = (v - (((((v >> 15) * (v >> 15)) >> 7) * h1) >> 4));
+        v = (v < 0) ? 0 : v;
+        v = (v > 419430400) ? 419430400 : v;
+        humidity[i] = (uint32_t)(v >> 12);
+    }
+}
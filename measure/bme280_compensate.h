@@ -0,0 +1,58 @@
+/**
+ * @file    bme280_compensate.h
+ * @brief   Batch compensation of raw BME280 samples in userspace
+ *
+ * The integer formulas from the BME280 datasheet (section 4.2.3 and
+ * appendix A), applied to whole arrays at once. Inputs and outputs are
+ * separate arrays (structure of arrays), so the temperature and humidity
+ * loops vectorize. Results are bit-exact with the datasheet reference code.
+ *
+ */
+
+#ifndef BME280_COMPENSATE_H_
+#define BME280_COMPENSATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bme280_ioctl.h"
+
+// Calibration coefficients decoded from a struct bme280_calib_block
+struct bme280_calib_params {
+    uint16_t dig_T1;
+    int16_t dig_T2;
+    int16_t dig_T3;
+    uint16_t dig_P1;
+    int16_t dig_P2;
+    int16_t dig_P3;
+    int16_t dig_P4;
+    int16_t dig_P5;
+    int16_t dig_P6;
+    int16_t dig_P7;
+    int16_t dig_P8;
+    int16_t dig_P9;
+    uint8_t dig_H1;
+    int16_t dig_H2;
+    uint8_t dig_H3;
+    int16_t dig_H4;
+    int16_t dig_H5;
+    int8_t dig_H6;
+};
+
+// Decode the raw NVM block returned by BME280_IOCGCALIB
+void bme280_calib_decode(const struct bme280_calib_block *raw, struct bme280_calib_params *params);
+
+// Temperature in 0.01 degC. t_fine receives the fine temperature that the
+// pressure and humidity formulas need.
+void bme280_compensate_temperature(const struct bme280_calib_params *params, const int32_t *adc_T,
+                                   size_t count, int32_t *temperature, int32_t *t_fine);
+
+// Pressure in Pa as Q24.8, from the 64-bit formula. 0 where the formula
+// would divide by zero.
+void bme280_compensate_pressure(const struct bme280_calib_params *params, const int32_t *adc_P,
+                                const int32_t *t_fine, size_t count, uint32_t *pressure);
+
+// Relative humidity in %RH as Q22.10
+void bme280_compensate_humidity(const struct bme280_calib_params *params, const int32_t *adc_H,
+                                const int32_t *t_fine, size_t count, uint32_t *humidity);
+
+#endif /* BME280_COMPENSATE_H_ */
@@ -0,0 +1,554 @@
+/**
+ * @file    bme280_compensate_bench.c
+ * @brief   Speed and correctness of the BME280 compensation code
+ *
+ * Runs a corpus of raw ADC samples through three implementations:
+ *   reference  the datasheet formulas as printed, one sample at a time
+ *   driver     the driver's own per-sample code from bme280_calc.h (T, P)
+ *   library    the batch loops of libbme280_compensate
+ * and reports ns/sample for each. Every output is checked against the
+ * reference, and a recorded corpus also against the values the driver
+ * computed when it was recorded. Cross-compile it to measure the cost on
+ * the 32-bit boards.
+ *
+ * A corpus file is CORPUS_MAGIC, the struct bme280_calib_block of the
+ * sensor, then struct bme280_sample records up to the end of the file.
+ * Record one on the board with -R.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <time.h>
+#include "bme280_ioctl.h"
+#include "bme280_calc.h"
+#include "bme280_compensate.h"
+
+#define CORPUS_MAGIC "BME280C1"
+#define CORPUS_MAGIC_LEN (8)
+#define DEFAULT_SAMPLES (65536)
+#define DEFAULT_MIN_TIME_S (0.5)
+#define RECORD_BATCH (16)       // Samples per read() while recording
+#define MISMATCHES_SHOWN (5)
+
+// Worked example of the datasheet, the first sample of the built-in corpus
+#define EXAMPLE_ADC_T (519888)
+#define EXAMPLE_ADC_P (415148)
+#define EXAMPLE_TEMPERATURE (2508)      // 25.08 degC
+#define EXAMPLE_PRESSURE (25767233)     // 100653.27 Pa as Q24.8
+
+// Structure of arrays, the layout the library works on
+struct corpus {
+    const char *name;
+    struct bme280_calib_params params;  // Decoded for the library and the reference
+    struct bme280_calib calib;          // Decoded for the driver code
+    size_t count;
+    int32_t *adc_T;
+    int32_t *adc_P;
+    int32_t *adc_H;
+    int recorded;                       // temperature and pressure below are valid
+    int32_t *temperature;
+    uint32_t *pressure;
+};
+
+struct outputs {
+    int32_t *temperature;
+    int32_t *t_fine;
+    uint32_t *pressure;
+    uint32_t *humidity;
+};
+
+// One implementation. run_H is NULL where humidity is not covered.
+struct bench_impl {
+    const char *name;
+    void (*run_T)(const struct corpus *c, struct outputs *out);
+    void (*run_P)(const struct corpus *c, struct outputs *out);
+    void (*run_H)(const struct corpus *c, struct outputs *out);
+};
+
+// Datasheet appendix 8.2, only the global t_fine turned into a parameter
+static int32_t ref_compensate_T(const struct bme280_calib_params *p, int32_t adc_T, int32_t *t_fine) {
+    int32_t var1, var2, T;
+
+    var1 = ((((adc_T >> 3) - ((int32_t)p->dig_T1 << 1))) * ((int32_t)p->dig_T2)) >> 11;
+    var2 = (((((adc_T >> 4) - ((int32_t)p->dig_T1)) * ((adc_T >> 4) - ((int32_t)p->dig_T1))) >> 12) *
+            ((int32_t)p->dig_T3)) >> 14;
+    *t_fine = var1 + var2;
+    T = (*t_fine * 5 + 128) >> 8;
+    return T;
+}
+
+static uint32_t ref_compensate_P(const struct bme280_calib_params *p, int32_t adc_P, int32_t t_fine) {
+    int64_t var1, var2, P;
+
+    var1 = ((int64_t)t_fine) - 128000;
+    var2 = var1 * var1 * (int64_t)p->dig_P6;
+    var2 = var2 + ((var1 * (int64_t)p->dig_P5) << 17);
+    var2 = var2 + (((int64_t)p->dig_P4) << 35);
+    var1 = ((var1 * var1 * (int64_t)p->dig_P3) >> 8) + ((var1 * (int64_t)p->dig_P2) << 12);
+    var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)p->dig_P1) >> 33;
+    if (var1 == 0) {
+        return 0;
+    }
+    P = 1048576 - adc_P;
+    P = (((P << 31) - var2) * 3125) / var1;
+    var1 = (((int64_t)p->dig_P9) * (P >> 13) * (P >> 13)) >> 25;
+    var2 = (((int64_t)p->dig_P8) * P) >> 19;
+    P = ((P + var1 + var2) >> 8) + (((int64_t)p->dig_P7) << 4);
+    return (uint32_t)P;
+}
+
+static uint32_t ref_compensate_H(const struct bme280_calib_params *p, int32_t adc_H, int32_t t_fine) {
+    int32_t v_x1_u32r;
+
+    v_x1_u32r = (t_fine - ((int32_t)76800));
+    v_x1_u32r = (((((adc_H << 14) - (((int32_t)p->dig_H4) << 20) - (((int32_t)p->dig_H5) * v_x1_u32r)) +
+                   ((int32_t)16384)) >> 15) * (((((((v_x1_u32r * ((int32_t)p->dig_H6)) >> 10) *
+                   (((v_x1_u32r * ((int32_t)p->dig_H3)) >> 11) + ((int32_t)32768))) >> 10) +
+                   ((int32_t)2097152)) * ((int32_t)p->dig_H2) + 8192) >> 14));
+    v_x1_u32r = (v_x1_u32r - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7) * ((int32_t)p->dig_H1)) >> 4));
+    v_x1_u32r = (v_x1_u32r < 0 ? 0 : v_x1_u32r);
+    v_x1_u32r = (v_x1_u32r > 419430400 ? 419430400 : v_x1_u32r);
+    return (uint32_t)(v_x1_u32r >> 12);
+}
+
+// The run functions stay out of line so every timed pass really runs
+
+static __attribute__((noinline)) void reference_T(const struct corpus *c, struct outputs *out) {
+    size_t i;
+
+    for (i = 0; i < c->count; i++) {
+        out->temperature[i] = ref_compensate_T(&c->params, c->adc_T[i], &out->t_fine[i]);
+    }
+}
+
+static __attribute__((noinline)) void reference_P(const struct corpus *c, struct outputs *out) {
+    size_t i;
+
+    for (i = 0; i < c->count; i++) {
+        out->pressure[i] = ref_compensate_P(&c->params, c->adc_P[i], out->t_fine[i]);
+    }
+}
+
+static __attribute__((noinline)) void reference_H(const struct corpus *c, struct outputs *out) {
+    size_t i;
+
+    for (i = 0; i < c->count; i++) {
+        out->humidity[i] = ref_compensate_H(&c->params, c->adc_H[i], out->t_fine[i]);
+    }
+}
+
+static __attribute__((noinline)) void driver_T(const struct corpus *c, struct outputs *out) {
+    size_t i;
+    s32 t_fine;
+
+    for (i = 0; i < c->count; i++) {
+        out->temperature[i] = bme280_temp_compensate(&c->calib, c->adc_T[i], &t_fine);
+        out->t_fine[i] = t_fine;
+    }
+}
+
+// The driver reports a division by zero as -1, the others as 0
+static __attribute__((noinline)) void driver_P(const struct corpus *c, struct outputs *out) {
+    size_t i;
+    long unsigned int P;
+
+    for (i = 0; i < c->count; i++) {
+        P = bme280_pressure_compensate(&c->calib, c->adc_P[i], out->t_fine[i]);
+        out->pressure[i] = P == (long unsigned int)-1 ? 0 : P;
+    }
+}
+
+static __attribute__((noinline)) void library_T(const struct corpus *c, struct outputs *out) {
+    bme280_compensate_temperature(&c->params, c->adc_T, c->count, out->temperature, out->t_fine);
+}
+
+static __attribute__((noinline)) void library_P(const struct corpus *c, struct outputs *out) {
+    bme280_compensate_pressure(&c->params, c->adc_P, out->t_fine, c->count, out->pressure);
+}
+
+static __attribute__((noinline)) void library_H(const struct corpus *c, struct outputs *out) {
+    bme280_compensate_humidity(&c->params, c->adc_H, out->t_fine, c->count, out->humidity);
+}
+
+static const struct bench_impl impls[] = {
+    { "reference", reference_T, reference_P, reference_H },
+    { "driver", driver_T, driver_P, NULL },
+    { "library", library_T, library_P, library_H },
+};
+
+#define IMPL_COUNT (sizeof(impls) / sizeof(impls[0]))
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Repeat whole passes over the corpus for at least min_time seconds
+static double time_pass(void (*run)(const struct corpus *, struct outputs *), const struct corpus *c,
+                        struct outputs *out, double min_time) {
+    double start = now_s();
+    double elapsed;
+    unsigned long passes = 0;
+
+    do {
+        run(c, out);
+        passes++;
+        elapsed = now_s() - start;
+    } while (elapsed < min_time);
+
+    return elapsed * 1e9 / ((double)passes * c->count);
+}
+
+static int outputs_alloc(struct outputs *out, size_t count) {
+    out->temperature = calloc(count, sizeof(int32_t));
+    out->t_fine = calloc(count, sizeof(int32_t));
+    out->pressure = calloc(count, sizeof(uint32_t));
+    out->humidity = calloc(count, sizeof(uint32_t));
+    return (out->temperature && out->t_fine && out->pressure && out->humidity) ? 0 : -1;
+}
+
+static void outputs_free(struct outputs *out) {
+    free(out->temperature);
+    free(out->t_fine);
+    free(out->pressure);
+    free(out->humidity);
+}
+
+static int corpus_alloc(struct corpus *c, size_t count) {
+    c->count = count;
+    c->adc_T = calloc(count, sizeof(int32_t));
+    c->adc_P = calloc(count, sizeof(int32_t));
+    c->adc_H = calloc(count, sizeof(int32_t));
+    c->temperature = calloc(count, sizeof(int32_t));
+    c->pressure = calloc(count, sizeof(uint32_t));
+    if (!c->adc_T || !c->adc_P || !c->adc_H || !c->temperature || !c->pressure) {
+        fprintf(stderr, "Failed to allocate a corpus of %zu samples\n", count);
+        return -1;
+    }
+    return 0;
+}
+
+static void corpus_free(struct corpus *c) {
+    free(c->adc_T);
+    free(c->adc_P);
+    free(c->adc_H);
+    free(c->temperature);
+    free(c->pressure);
+}
+
+static void corpus_set_calib(struct corpus *c, const struct bme280_calib_block *block) {
+    const struct bme280_calib_params *p = &c->params;
+
+    bme280_calib_decode(block, &c->params);
+    c->calib.dig_T1 = p->dig_T1;
+    c->calib.dig_T2 = p->dig_T2;
+    c->calib.dig_T3 = p->dig_T3;
+    c->calib.dig_P1 = p->dig_P1;
+    c->calib.dig_P2 = p->dig_P2;
+    c->calib.dig_P3 = p->dig_P3;
+    c->calib.dig_P4 = p->dig_P4;
+    c->calib.dig_P5 = p->dig_P5;
+    c->calib.dig_P6 = p->dig_P6;
+    c->calib.dig_P7 = p->dig_P7;
+    c->calib.dig_P8 = p->dig_P8;
+    c->calib.dig_P9 = p->dig_P9;
+    bme280_calib_derive(&c->calib);
+}
+
+static void put_le16(uint8_t *data, int value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+}
+
+// The example calibration of the Bosch reference driver, with pseudo-random
+// readings spread over the sensor's operating range (-40..85 degC,
+// 300..1100 hPa). The datasheet's worked example comes first.
+static int corpus_builtin(struct corpus *c, size_t count) {
+    static const int tp[] = { 27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000 };
+    struct bme280_calib_block block;
+    uint32_t state = 0x2545F491;
+    size_t i;
+
+    memset(&block, 0, sizeof(block));
+    for (i = 0; i < sizeof(tp) / sizeof(tp[0]); i++) {
+        put_le16(&block.tp[i * 2], tp[i]);
+    }
+    block.tp[25] = 75;                      // dig_H1
+    put_le16(&block.h[0], 362);             // dig_H2
+    block.h[2] = 0;                         // dig_H3
+    block.h[3] = 313 >> 4;                  // dig_H4 [11:4]
+    block.h[4] = (313 & 0x0F) | ((50 & 0x0F) << 4);   // dig_H4 [3:0], dig_H5 [3:0]
+    block.h[5] = 50 >> 4;                   // dig_H5 [11:4]
+    block.h[6] = 30;                        // dig_H6
+
+    if (corpus_alloc(c, count) != 0) {
+        return -1;
+    }
+    c->name = "builtin";
+    corpus_set_calib(c, &block);
+
+    for (i = 0; i < count; i++) {
+        // xorshift32, so every run sees the same corpus
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        c->adc_T[i] = 380000 + state % 300000;
+        c->adc_P[i] = 200000 + (state >> 8) % 420000;
+        c->adc_H[i] = (state >> 4) & 0xFFFF;
+    }
+    if (count > 0) {
+        c->adc_T[0] = EXAMPLE_ADC_T;
+        c->adc_P[0] = EXAMPLE_ADC_P;
+    }
+    return 0;
+}
+
+static int corpus_load(struct corpus *c, const char *path, size_t max_count) {
+    char magic[CORPUS_MAGIC_LEN];
+    struct bme280_calib_block block;
+    struct bme280_sample sample;
+    size_t count, i;
+    long size;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Failed to open corpus");
+        return -1;
+    }
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, CORPUS_MAGIC, CORPUS_MAGIC_LEN) != 0 ||
+        fread(&block, sizeof(block), 1, file) != 1) {
+        fprintf(stderr, "%s is not a BME280 corpus\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, CORPUS_MAGIC_LEN + sizeof(block), SEEK_SET);
+    count = (size - CORPUS_MAGIC_LEN - sizeof(block)) / sizeof(sample);
+    if (max_count != 0 && count > max_count) {
+        count = max_count;
+    }
+    if (count == 0) {
+        fprintf(stderr, "%s holds no samples\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if (corpus_alloc(c, count) != 0) {
+        fclose(file);
+        return -1;
+    }
+    c->name = path;
+    c->recorded = 1;
+    corpus_set_calib(c, &block);
+    for (i = 0; i < count && fread(&sample, sizeof(sample), 1, file) == 1; i++) {
+        c->adc_T[i] = sample.adc_T;
+        c->adc_P[i] = sample.adc_P;
+        c->adc_H[i] = sample.adc_H;
+        c->temperature[i] = sample.temperature;
+        c->pressure[i] = sample.pressure;
+    }
+    c->count = i;
+    fclose(file);
+    return 0;
+}
+
+// Record a corpus from the driver
+static int corpus_record(const char *device, const char *path, size_t count) {
+    struct bme280_sample samples[RECORD_BATCH];
+    struct bme280_calib_block block;
+    int mode = BME280_READ_BINARY;
+    size_t recorded = 0;
+    ssize_t bytes;
+    FILE *file;
+    int fd;
+
+    fd = open(device, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open BME280 device");
+        return -1;
+    }
+    if (ioctl(fd, BME280_IOCGCALIB, &block) < 0 || ioctl(fd, BME280_IOCSMODE, &mode) < 0) {
+        perror("Failed to set up BME280 device");
+        close(fd);
+        return -1;
+    }
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Failed to create corpus");
+        close(fd);
+        return -1;
+    }
+    fwrite(CORPUS_MAGIC, CORPUS_MAGIC_LEN, 1, file);
+    fwrite(&block, sizeof(block), 1, file);
+
+    // In normal mode one read drains whatever the driver has buffered
+    while (recorded < count) {
+        size_t wanted = count - recorded < RECORD_BATCH ? count - recorded : RECORD_BATCH;
+
+        bytes = read(fd, samples, wanted * sizeof(samples[0]));
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to read BME280 sample");
+            break;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        fwrite(samples, sizeof(samples[0]), bytes / sizeof(samples[0]), file);
+        recorded += bytes / sizeof(samples[0]);
+    }
+
+    close(fd);
+    if (fclose(file) != 0) {
+        perror("Failed to write corpus");
+        return -1;
+    }
+    printf("Recorded %zu samples to %s\n", recorded, path);
+    return recorded == count ? 0 : -1;
+}
+
+static size_t compare(const char *impl, const char *what, const uint32_t *got, const uint32_t *expected,
+                      const struct corpus *c) {
+    size_t mismatches = 0;
+    size_t i;
+
+    for (i = 0; i < c->count; i++) {
+        if (got[i] == expected[i]) {
+            continue;
+        }
+        if (mismatches++ < MISMATCHES_SHOWN) {
+            fprintf(stderr, "%s %s mismatch at sample %zu (adc_T %d, adc_P %d, adc_H %d): %u, expected %u\n",
+                    impl, what, i, c->adc_T[i], c->adc_P[i], c->adc_H[i], got[i], expected[i]);
+        }
+    }
+    return mismatches;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f corpus] [-n samples] [-t seconds]\n"
+                    "       %s -R device -o corpus [-n samples]\n"
+                    "  -f  corpus file recorded with -R (default: built-in corpus)\n"
+                    "  -n  number of samples to use or record (default %d)\n"
+                    "  -t  minimum time spent timing each routine (default %g)\n"
+                    "  -R  record a corpus from this BME280 device into the -o file\n",
+            prog, prog, DEFAULT_SAMPLES, DEFAULT_MIN_TIME_S);
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus_path = NULL;
+    const char *record_device = NULL;
+    const char *output_path = NULL;
+    size_t count = 0;
+    double min_time = DEFAULT_MIN_TIME_S;
+    struct corpus corpus;
+    struct outputs reference, out;
+    size_t mismatches = 0;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:t:R:o:")) != -1) {
+        switch (opt) {
+        case 'f':
+            corpus_path = optarg;
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'R':
+            record_device = optarg;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (record_device != NULL) {
+        if (output_path == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        return corpus_record(record_device, output_path, count ? count : DEFAULT_SAMPLES) == 0 ? 0 : 1;
+    }
+
+    memset(&corpus, 0, sizeof(corpus));
+    if (corpus_path != NULL ? corpus_load(&corpus, corpus_path, count) != 0
+                            : corpus_builtin(&corpus, count ? count : DEFAULT_SAMPLES) != 0) {
+        corpus_free(&corpus);
+        return 1;
+    }
+    if (outputs_alloc(&reference, corpus.count) != 0 || outputs_alloc(&out, corpus.count) != 0) {
+        fprintf(stderr, "Failed to allocate output buffers\n");
+        return 1;
+    }
+
+    // The reference outputs everything else is held against
+    reference_T(&corpus, &reference);
+    reference_P(&corpus, &reference);
+    reference_H(&corpus, &reference);
+
+    // The reference itself has to reproduce the datasheet
+    if (!corpus.recorded &&
+        (reference.temperature[0] != EXAMPLE_TEMPERATURE || reference.pressure[0] != EXAMPLE_PRESSURE)) {
+        fprintf(stderr, "Reference gives %d and %u for the datasheet example, expected %d and %d\n",
+                reference.temperature[0], reference.pressure[0], EXAMPLE_TEMPERATURE, EXAMPLE_PRESSURE);
+        mismatches++;
+    }
+
+    printf("corpus %s, %zu samples, %zu-bit long\n", corpus.name, corpus.count, sizeof(long) * 8);
+    printf("%-10s %10s %10s %10s %10s %11s\n", "", "T ns", "P ns", "H ns", "total ns", "mismatches");
+    for (i = 0; i < IMPL_COUNT; i++) {
+        const struct bench_impl *impl = &impls[i];
+        double t_ns, p_ns, h_ns = 0;
+        size_t bad;
+
+        // P and H consume the t_fine the T pass leaves behind
+        t_ns = time_pass(impl->run_T, &corpus, &out, min_time);
+        p_ns = time_pass(impl->run_P, &corpus, &out, min_time);
+        bad = compare(impl->name, "temperature", (const uint32_t *)out.temperature,
+                      (const uint32_t *)reference.temperature, &corpus);
+        bad += compare(impl->name, "pressure", out.pressure, reference.pressure, &corpus);
+        if (impl->run_H != NULL) {
+            h_ns = time_pass(impl->run_H, &corpus, &out, min_time);
+            bad += compare(impl->name, "humidity", out.humidity, reference.humidity, &corpus);
+            printf("%-10s %10.2f %10.2f %10.2f %10.2f %11zu\n", impl->name, t_ns, p_ns, h_ns, t_ns + p_ns + h_ns, bad);
+        } else {
+            printf("%-10s %10.2f %10.2f %10s %10.2f %11zu\n", impl->name, t_ns, p_ns, "-", t_ns + p_ns, bad);
+        }
+        mismatches += bad;
+    }
+
+    // Values the driver produced on the board, where long is 32 bits
+    if (corpus.recorded) {
+        size_t bad = compare("recorded", "temperature", (const uint32_t *)corpus.temperature,
+                             (const uint32_t *)reference.temperature, &corpus);
+        bad += compare("recorded", "pressure", corpus.pressure, reference.pressure, &corpus);
+        printf("recorded driver output: %zu mismatches\n", bad);
+        mismatches += bad;
+    }
+
+    outputs_free(&reference);
+    outputs_free(&out);
+    corpus_free(&corpus);
+    return mismatches == 0 ? 0 : 1;
+}
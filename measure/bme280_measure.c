@@ -2,141 +2,654 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sqlite3.h>
 #include <time.h>
+#include <signal.h>
+#include <math.h>
+#include "bme280_ioctl.h"
 #define BME280_DEV "/dev/bme280"
-#define LONG_SIGNED_INT_NUM (25)
+#define DEFAULT_DB_PATH "finalProject.db"  // Read by aesdsocket from the same directory
+#define REPLAY_LINE_MAX (256)
 
-int main() {
-    int retval = 0;
-    // Open connection to the database
+// Group commit: samples are buffered in memory and written in one
+// transaction once BATCH_SAMPLES are pending or the oldest pending sample is
+// BATCH_MAX_AGE_S old, whichever comes first. A crash loses at most that
+// window; SIGINT/SIGTERM flush the pending samples before exiting.
+// Readers only see a sample once it is committed: aesdsocket's subscribe
+// push and get10 ring, and the UI through them. So the default commits
+// every sample; larger batches trade that freshness for fewer syncs and
+// are opted into with -b and -t.
+#define DEFAULT_BATCH_SAMPLES (1)
+#define DEFAULT_BATCH_MAX_AGE_S (5)
+#define DEFAULT_SAMPLE_INTERVAL_S (5.0)
+
+struct sample {
+    int timestamp;
+    double temperature;
+    double humidity;
+    double pressure;
+};
+
+struct sample_batch {
+    struct sample *samples;
+    int count;
+    int capacity;
+    time_t max_age;
+    struct timespec first_pending;  // CLOCK_MONOTONIC time of samples[0]
+};
+
+static volatile sig_atomic_t exit_requested = 0;
+
+static void signal_handler(int signo) {
+    (void)signo;
+    exit_requested = 1;
+}
+
+// Schema migrations, applied in order. PRAGMA user_version records how many
+// have run, so each one is applied exactly once to any existing database.
+static const char *const schema_migrations[] = {
+    // 1: the original table (a no-op on databases created before versioning)
+    "CREATE TABLE IF NOT EXISTS sensor_data ("
+    "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "timestamp INTEGER,"
+    "temperature REAL,"
+    "humidity REAL,"
+    "pressure REAL);",
+    // 2: serve ORDER BY timestamp and time range queries without a full scan
+    "CREATE INDEX IF NOT EXISTS sensor_data_timestamp ON sensor_data (timestamp);",
+};
+
+#define SCHEMA_VERSION ((int)(sizeof(schema_migrations) / sizeof(schema_migrations[0])))
+
+static int get_user_version(sqlite3 *db) {
+    sqlite3_stmt *stmt;
+    int version = -1;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+// Bring the database schema up to SCHEMA_VERSION
+static int migrate_schema(sqlite3 *db) {
+    char *errMsg = 0;
+    char sql[64];
+
+    // Wait for other writers instead of failing on a locked database
+    sqlite3_busy_timeout(db, 5000);
+
+    // IMMEDIATE takes the write lock before user_version is read, so two
+    // processes starting together cannot both apply the same step
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, 0, &errMsg) != SQLITE_OK) {
+        fprintf(stderr, "Failed to start schema migration: %s\n", errMsg);
+        sqlite3_free(errMsg);
+        return -1;
+    }
+
+    int version = get_user_version(db);
+    if (version < 0) {
+        fprintf(stderr, "Failed to read schema version: %s\n", sqlite3_errmsg(db));
+        goto rollback;
+    }
 
+    for (; version < SCHEMA_VERSION; version++) {
+        if (sqlite3_exec(db, schema_migrations[version], NULL, 0, &errMsg) != SQLITE_OK) {
+            fprintf(stderr, "Schema migration %d failed: %s\n", version + 1, errMsg);
+            sqlite3_free(errMsg);
+            goto rollback;
+        }
+        printf("Applied schema migration %d\n", version + 1);
+    }
+
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", version);
+    if (sqlite3_exec(db, sql, NULL, 0, &errMsg) != SQLITE_OK ||
+        sqlite3_exec(db, "COMMIT;", NULL, 0, &errMsg) != SQLITE_OK) {
+        fprintf(stderr, "Failed to commit schema migration: %s\n", errMsg);
+        sqlite3_free(errMsg);
+        goto rollback;
+    }
+    return 0;
+
+rollback:
+    sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+    return -1;
+}
+
+struct measure;
+
+// Values returned by sample_source.read, besides -1 for a fatal error
+enum {
+    SOURCE_SAMPLE = 0,  // *sample was filled in
+    SOURCE_RETRY,       // Nothing this time, e.g. interrupted by a signal
+    SOURCE_SKIP,        // This sample failed; try again at the next slot
+    SOURCE_END,         // Input exhausted, stop after flushing
+};
+
+// Where samples come from. The device source talks to the driver; the
+// others need no hardware, so the batch and insert path can be load tested
+// on any machine.
+struct sample_source {
+    const char *name;
+    int (*open)(struct measure *m, const char *arg);
+    int (*read)(struct measure *m, struct sample *sample);
+    void (*close)(struct measure *m);
+};
+
+// Everything the daemon holds between init and teardown. The steady state
+// only reads the source, binds and steps these statements.
+struct measure {
+    const struct sample_source *source;
+    const char *source_arg;
+    int dev_fd;                 // device source
+    FILE *replay;               // replay source
+    unsigned long generated;    // synthetic source
+    int last_timestamp;         // synthetic source
+
+    const char *db_path;        // NULL = DEFAULT_DB_PATH
     sqlite3 *db;
-    int bme280_dev_fd;
-    char temp_buffer[LONG_SIGNED_INT_NUM] = "123";
-    uint8_t num_bytes_read = 0;
+    sqlite3_stmt *insert_stmt;
+    sqlite3_stmt *begin_stmt;
+    sqlite3_stmt *commit_stmt;
+    sqlite3_stmt *rollback_stmt;
+    struct sample_batch batch;
+    double sample_interval;     // Seconds, 0 = as fast as the pipeline goes
+    unsigned long max_samples;  // 0 = unlimited
+    unsigned long stored;
+    int verbose;                // Report every commit
+};
+
+static int prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt) {
+    if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare \"%s\": %s\n", sql, sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+// Run a statement without result rows and make it ready for the next use
+static int step_once(sqlite3 *db, sqlite3_stmt *stmt) {
+    int rc = sqlite3_step(stmt);
+
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to execute statement: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+static void timespec_add_ns(struct timespec *t, long long ns) {
+    t->tv_sec += ns / 1000000000;
+    t->tv_nsec += ns % 1000000000;
+    if (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void batch_add(struct sample_batch *batch, const struct sample *sample) {
+    if (batch->count == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &batch->first_pending);
+    }
+    batch->samples[batch->count++] = *sample;
+}
+
+// CLOCK_MONOTONIC time at which the pending samples have waited max_age
+static void batch_deadline(const struct sample_batch *batch, struct timespec *deadline) {
+    *deadline = batch->first_pending;
+    deadline->tv_sec += batch->max_age;
+}
+
+static int batch_due(const struct sample_batch *batch) {
+    struct timespec now;
+    struct timespec deadline;
+
+    if (batch->count == 0) {
+        return 0;
+    }
+    if (batch->count >= batch->capacity) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    batch_deadline(batch, &deadline);
+    return !timespec_before(&now, &deadline);
+}
+
+// Write every pending sample in a single transaction, so the whole batch
+// costs one journal sync instead of one per row
+static int batch_flush(struct measure *m) {
+    struct sample_batch *batch = &m->batch;
+    int i;
+
+    if (batch->count == 0) {
+        return 0;
+    }
+
+    if (step_once(m->db, m->begin_stmt) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        sqlite3_bind_int(m->insert_stmt, 1, batch->samples[i].timestamp);
+        sqlite3_bind_double(m->insert_stmt, 2, batch->samples[i].temperature);
+        sqlite3_bind_double(m->insert_stmt, 3, batch->samples[i].humidity);
+        sqlite3_bind_double(m->insert_stmt, 4, batch->samples[i].pressure);
+
+        if (step_once(m->db, m->insert_stmt) != 0) {
+            goto rollback;
+        }
+    }
+
+    if (step_once(m->db, m->commit_stmt) != 0) {
+        goto rollback;
+    }
+
+    if (m->verbose) {
+        printf("Committed %d samples\n", batch->count);
+    }
+    m->stored += batch->count;
+    batch->count = 0;
+    return 0;
+
+rollback:
+    step_once(m->db, m->rollback_stmt);
+    return -1;
+}
+
+// Init phase: open the sample source and database, bring the schema up to date and
+// prepare every statement the steady state needs
+static int measure_init(struct measure *m) {
+    m->batch.samples = calloc(m->batch.capacity, sizeof(*m->batch.samples));
+    if (m->batch.samples == NULL) {
+        perror("Failed to allocate sample batch");
+        return -1;
+    }
+
+    if (m->source->open(m, m->source_arg) != 0) {
+        return -1;
+    }
+
+    if (sqlite3_open(m->db_path ? m->db_path : DEFAULT_DB_PATH, &m->db) != SQLITE_OK) {
+        fprintf(stderr, "Failed to open/create database: %s\n", sqlite3_errmsg(m->db));
+        return -1;
+    }
 
-    long signed int temperaturef, pressf;
-    char *endptr;
+    // Create or upgrade the schema once, before the first sample
+    if (migrate_schema(m->db) != 0) {
+        return -1;
+    }
+
+    // WAL keeps aesdsocket's readers and this writer from blocking each other
+    if (sqlite3_exec(m->db, "PRAGMA journal_mode=WAL;", NULL, 0, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to enable WAL mode: %s\n", sqlite3_errmsg(m->db));
+    }
+
+    if (prepare(m->db, "INSERT INTO sensor_data (timestamp, temperature, humidity, pressure) VALUES (?, ?, ?, ?);",
+                &m->insert_stmt) != 0 ||
+        prepare(m->db, "BEGIN IMMEDIATE;", &m->begin_stmt) != 0 ||
+        prepare(m->db, "COMMIT;", &m->commit_stmt) != 0 ||
+        prepare(m->db, "ROLLBACK;", &m->rollback_stmt) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int device_open(struct measure *m, const char *arg) {
     // Open I2C device file
-    bme280_dev_fd = open(BME280_DEV, O_CREAT | O_RDWR, 0744);
-    if (bme280_dev_fd < 0)
-    {
+    m->dev_fd = open(arg ? arg : BME280_DEV, O_RDWR);
+    if (m->dev_fd < 0) {
         perror("Failed to open I2C device file");
         return -1;
     }
-    if (sqlite3_open("finalProject.db", &db) != SQLITE_OK) {
-        // If the database doesn't exist, create it
-        if (sqlite3_open("finalProject.db", &db) == SQLITE_OK) {
-            // Perform any initial setup here if needed
-        } else {
-            fprintf(stderr, "Failed to open/create database: %s\n", sqlite3_errmsg(db));
-            return 1;
+    return 0;
+}
+
+// Read one sample from the driver
+static int device_read(struct measure *m, struct sample *sample) {
+    struct bme280_sample raw;
+
+    // The driver hands back a binary sample, so there is nothing to parse
+    if (ioctl(m->dev_fd, BME280_IOCGSAMPLE, &raw) < 0) {
+        if (errno == EINTR) {
+            return SOURCE_RETRY;
+        }
+        if (errno == EIO) {
+            fprintf(stderr, "BME280 measurement failed, skipping sample\n");
+            return SOURCE_SKIP;
         }
+        perror("Failed to read temperature from BME280 sensor");
+        return -1;
     }
-    while (1) {
-        // Read temperature from BME280 sensor
-        num_bytes_read = read(bme280_dev_fd, temp_buffer, LONG_SIGNED_INT_NUM);
-        if (num_bytes_read < 0)
-        {
-            perror("Failed to read temperature from BME280 sensor");
-            retval = -1;
-            goto close_and_exit;
-        }
-
-        //printf("Value returned into the temperature buffer = %s\n", temp_buffer);
-
-        // Convert temperature obtained in the buffer into int
-        temperaturef = strtol(temp_buffer, &endptr, 10);
-        pressf = strtol(endptr, &endptr, 10);
-        if(errno)
-        {
-            perror("Failed to convert string to a numerical value, errno: ");
-            printf("%s", strerror(errno));
-            retval = -1;
-            goto close_and_exit;
-        } else if (endptr == temp_buffer) {
-            perror("No digits were found in the string");
-            retval = -1;
-            goto close_and_exit;
-        }
-        if((*endptr != '\0') && (*endptr != 0x20))
-        {
-            printf("%d\n\r", (int)*endptr);
-            perror("Failed to convert string to a numerical value, endptr != 0");
-            retval = -1;
-            goto close_and_exit;
-        }
-        // Print temperature
-        printf("Temperature: %ld.%ldC\n", temperaturef/100, temperaturef % 100);
-        printf("Pressure: %ld.%ldC\n", pressf/100, pressf % 100);
-
-        char *errMsg = 0;
-
-
-
-        // SQL statement for table creation if it doesn't exist
-        const char *createTableSQL = "CREATE TABLE IF NOT EXISTS sensor_data ("
-                                     "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                                     "timestamp INTEGER,"
-                                     "temperature REAL,"
-                                     "humidity REAL,"
-                                     "pressure REAL);";
-
-        // Execute the SQL statement to create the table
-        if (sqlite3_exec(db, createTableSQL, NULL, 0, &errMsg) != SQLITE_OK) {
-            fprintf(stderr, "Failed to create table: %s\n", errMsg);
-            sqlite3_free(errMsg);
-            sqlite3_close(db);
-            return 1;
+
+    printf("Temperature: %.2fC\n", raw.temperature / 100.0);
+    printf("Pressure: %.2f\n", raw.pressure / 100.0);
+
+    sample->timestamp = raw.timestamp_ns / 1000000000;
+    sample->temperature = raw.temperature / 100.0;
+    sample->humidity = -1;
+    sample->pressure = raw.pressure / 100.0;
+    return SOURCE_SAMPLE;
+}
+
+static void device_close(struct measure *m) {
+    if (m->dev_fd >= 0) {
+        close(m->dev_fd);
+    }
+}
+
+static int synthetic_open(struct measure *m, const char *arg) {
+    (void)arg;
+    m->generated = 0;
+    m->last_timestamp = 0;
+    return 0;
+}
+
+// Slow sine waves around typical indoor readings, stamped with the current time.
+// Timestamps are whole seconds in the schema, so at more than one sample per
+// second each one is stamped a second after the previous instead: every row
+// keeps a distinct, increasing timestamp, and latest-first queries see them
+// in the order they were generated.
+static int synthetic_read(struct measure *m, struct sample *sample) {
+    double phase = (double)m->generated++ / 600.0;
+    int now = time(NULL);
+
+    m->last_timestamp = now > m->last_timestamp ? now : m->last_timestamp + 1;
+    sample->timestamp = m->last_timestamp;
+    sample->temperature = 22.0 + 3.0 * sin(phase);
+    sample->humidity = 45.0 + 10.0 * sin(phase / 3.0);
+    sample->pressure = 1013.25 + 8.0 * cos(phase / 7.0);
+    return SOURCE_SAMPLE;
+}
+
+static void synthetic_close(struct measure *m) {
+    (void)m;
+}
+
+static int replay_open(struct measure *m, const char *arg) {
+    if (arg == NULL) {
+        fprintf(stderr, "The replay source needs a file, e.g. -s replay:samples.csv\n");
+        return -1;
+    }
+    m->replay = fopen(arg, "r");
+    if (m->replay == NULL) {
+        perror("Failed to open replay file");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the next "timestamp,temperature,humidity,pressure" line, the format
+// of sqlite3 -csv on sensor_data. Commas or whitespace separate the fields;
+// lines that do not start with a number, such as headers, are skipped.
+static int replay_read(struct measure *m, struct sample *sample) {
+    char line[REPLAY_LINE_MAX];
+    double *fields[] = { &sample->temperature, &sample->humidity, &sample->pressure };
+    char *pos, *endptr;
+    long timestamp;
+    int i;
+
+    while (fgets(line, sizeof(line), m->replay) != NULL) {
+        timestamp = strtol(line, &endptr, 10);
+        if (endptr == line) {
+            continue;
+        }
+        pos = endptr;
+        for (i = 0; i < 3; i++) {
+            pos += strspn(pos, ", \t");
+            *fields[i] = strtod(pos, &endptr);
+            if (endptr == pos) {
+                break;
+            }
+            pos = endptr;
+        }
+        if (i < 3) {
+            fprintf(stderr, "Skipping malformed replay line: %s", line);
+            continue;
+        }
+        sample->timestamp = timestamp;
+        return SOURCE_SAMPLE;
+    }
+    return SOURCE_END;
+}
+
+static void replay_close(struct measure *m) {
+    if (m->replay != NULL) {
+        fclose(m->replay);
+    }
+}
+
+static const struct sample_source sample_sources[] = {
+    { "device", device_open, device_read, device_close },
+    { "synthetic", synthetic_open, synthetic_read, synthetic_close },
+    { "replay", replay_open, replay_read, replay_close },
+};
+
+// Look up "name" or "name:arg"
+static int select_source(struct measure *m, char *spec) {
+    char *arg = strchr(spec, ':');
+    size_t i;
+
+    if (arg != NULL) {
+        *arg++ = '\0';
+    }
+    for (i = 0; i < sizeof(sample_sources) / sizeof(sample_sources[0]); i++) {
+        if (strcmp(spec, sample_sources[i].name) == 0) {
+            m->source = &sample_sources[i];
+            m->source_arg = arg;
+            return 0;
         }
+    }
+    fprintf(stderr, "Unknown sample source: %s\n", spec);
+    return -1;
+}
 
-        // SQL statement for insertion
-        const char *insertSQL = "INSERT INTO sensor_data (timestamp, temperature, humidity, pressure) VALUES (?, ?, ?, ?)";
+// Move next one interval on and sleep until that absolute CLOCK_MONOTONIC
+// time. Pacing against a fixed timeline keeps the rate exact even when
+// reading and committing take time. A pending batch that reaches its max
+// age meanwhile is committed on time instead of waiting for the next sample,
+// so no sample stays unwritten longer than -t seconds.
+static int wait_next_sample(struct measure *m, struct timespec *next) {
+    long long interval_ns = (long long)(m->sample_interval * 1e9);
+    struct timespec wake;
+    struct timespec deadline;
 
-        // Prepare the SQL statement
-        sqlite3_stmt *stmt;
-        if (sqlite3_prepare_v2(db, insertSQL, -1, &stmt, NULL) != SQLITE_OK) {
-            fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-            sqlite3_close(db);
-            return 1;
+    if (interval_ns <= 0) {
+        return 0;
+    }
+    timespec_add_ns(next, interval_ns);
+    for (;;) {
+        wake = *next;
+        if (m->batch.count > 0) {
+            batch_deadline(&m->batch, &deadline);
+            if (timespec_before(&deadline, &wake)) {
+                wake = deadline;
+            }
+        }
+        // A signal cuts the sleep short, and the loop then sees exit_requested
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0) {
+            return 0;
+        }
+        if (batch_due(&m->batch) && batch_flush(m) != 0) {
+            return -1;
+        }
+        if (!timespec_before(&wake, next)) {
+            return 0;
         }
+    }
+}
 
-        // Bind values to the prepared statement
-        // Example values, replace with your own
-        int timestamp = time(NULL);
-        double temperature = temperaturef/100;
-        double humidity = -1;
-        double pressure = pressf/100;
+// Steady state: read, buffer, and commit whenever a batch is due. Runs
+// until a signal asks the daemon to stop.
+static int measure_run(struct measure *m) {
+    struct sample sample;
+    struct timespec next;
+    unsigned long taken = 0;
+    int rc;
 
-        sqlite3_bind_int(stmt, 1, timestamp);
-        sqlite3_bind_double(stmt, 2, temperature);
-        sqlite3_bind_double(stmt, 3, humidity);
-        sqlite3_bind_double(stmt, 4, pressure);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!exit_requested && (m->max_samples == 0 || taken < m->max_samples)) {
+        rc = m->source->read(m, &sample);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == SOURCE_END) {
+            break;
+        }
+        if (rc == SOURCE_RETRY) {
+            continue;
+        }
+        // Keep the pacing, so a failing sensor is not hammered in a tight loop
+        if (rc == SOURCE_SKIP) {
+            if (wait_next_sample(m, &next) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        taken++;
 
-        // Execute the SQL statement
-        if (sqlite3_step(stmt) != SQLITE_DONE) {
-            fprintf(stderr, "Failed to execute statement: %s\n", sqlite3_errmsg(db));
-            sqlite3_finalize(stmt);
-            sqlite3_close(db);
-            return 1;
+        // Buffer the sample; it reaches the database with the rest of its batch
+        batch_add(&m->batch, &sample);
+        if (batch_due(&m->batch) && batch_flush(m) != 0) {
+            return -1;
         }
 
-        // Finalize the statement and close the database connection
-        sqlite3_finalize(stmt);
+        // Delay until the next sample
+        if (wait_next_sample(m, &next) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Teardown phase: release everything measure_init acquired. Safe to call
+// after a partial init.
+static void measure_teardown(struct measure *m) {
+    sqlite3_finalize(m->insert_stmt);
+    sqlite3_finalize(m->begin_stmt);
+    sqlite3_finalize(m->commit_stmt);
+    sqlite3_finalize(m->rollback_stmt);
+    sqlite3_close(m->db);
+    m->source->close(m);
+    free(m->batch.samples);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b samples] [-t seconds] [-i seconds] [-n samples] [-s source[:arg]] [-d database] [-v]\n"
+                    "  -b  commit after this many samples (default %d); readers see a sample\n"
+                    "      only once it is committed, so larger batches delay them\n"
+                    "  -t  commit once the oldest pending sample is this many seconds old (default %d)\n"
+                    "  -i  seconds between samples, fractions allowed, 0 = no delay (default %g)\n"
+                    "  -n  stop after this many samples (default: run until signalled)\n"
+                    "  -s  sample source (default device:%s)\n"
+                    "        device[:path]  the BME280 driver\n"
+                    "        synthetic      generated readings, no hardware needed\n"
+                    "        replay:file    timestamp,temperature,humidity,pressure lines\n"
+                    "  -d  database file (default %s); required with the synthetic and\n"
+                    "      replay sources, so test data never lands in the live database\n"
+                    "  -v  report every commit\n",
+            prog, DEFAULT_BATCH_SAMPLES, DEFAULT_BATCH_MAX_AGE_S, DEFAULT_SAMPLE_INTERVAL_S, BME280_DEV,
+            DEFAULT_DB_PATH);
+}
+
+int main(int argc, char *argv[]) {
+    int retval = 0;
+    struct measure m = {
+        .source = &sample_sources[0],
+        .dev_fd = -1,
+        .batch = {
+            .capacity = DEFAULT_BATCH_SAMPLES,
+            .max_age = DEFAULT_BATCH_MAX_AGE_S,
+        },
+        .sample_interval = DEFAULT_SAMPLE_INTERVAL_S,
+    };
+    struct sigaction action;
+    struct timespec start, end;
+    double elapsed;
+    int run_rc;
+    int opt;
 
+    while ((opt = getopt(argc, argv, "b:t:i:n:s:d:v")) != -1) {
+        switch (opt) {
+        case 'b':
+            m.batch.capacity = atoi(optarg);
+            break;
+        case 't':
+            m.batch.max_age = atoi(optarg);
+            break;
+        case 'i':
+            m.sample_interval = atof(optarg);
+            break;
+        case 'n':
+            m.max_samples = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            if (select_source(&m, optarg) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            m.db_path = optarg;
+            break;
+        case 'v':
+            m.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (m.source != &sample_sources[0] && m.db_path == NULL) {
+        fprintf(stderr, "The %s source needs -d, to keep its samples out of %s\n", m.source->name, DEFAULT_DB_PATH);
+        usage(argv[0]);
+        return 1;
+    }
+    if (m.batch.capacity < 1 || m.batch.max_age < 0 || m.sample_interval < 0) {
+        usage(argv[0]);
+        return 1;
+    }
 
+    // No SA_RESTART, so a signal interrupts the device read and the pacing
+    // sleep, and the pending batch is flushed promptly
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
 
+    if (measure_init(&m) != 0) {
+        measure_teardown(&m);
+        return 1;
+    }
 
-        // Delay for 5 seconds
-        sleep(5);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Don't lose the pending samples, whether the run was asked to stop or
+    // failed; a run error takes precedence in the exit status
+    run_rc = measure_run(&m);
+    if (batch_flush(&m) != 0) {
+        retval = 1;
+    }
+    if (run_rc != 0) {
+        retval = -1;
     }
-    close_and_exit:
-        // Close I2C device file
-        sqlite3_close(db);
-        close(bme280_dev_fd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Stored %lu samples in %.3f s (%.0f samples/s)\n",
+           m.stored, elapsed, elapsed > 0 ? m.stored / elapsed : 0.0);
+
+    measure_teardown(&m);
     return retval;
 }
@@ -0,0 +1,810 @@
+/*
+ * File: aesdbench.c
+ * Description: Load generator for aesdsocket. Opens N concurrent connections, sends
+ *              commands at a target rate and reports throughput together with connect
+ *              and query latency histograms.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "9000"
+#define DEFAULT_CONNECTIONS 1
+#define DEFAULT_THREADS 1
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_COMMAND "get10"
+#define DEFAULT_TIMEOUT_S 5
+
+// Most commands that can be given with -m
+#define MAX_COMMANDS 16
+
+// Size of the receive buffer of each thread
+#define RECV_BUFFER_SIZE 16384
+
+#define BENCH_MAX_EVENTS 64
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+// Log-linear histogram in the style of HdrHistogram: every power of two is split
+// into HIST_SUB_BUCKETS / 2 linear buckets, so any recorded value is off by less
+// than 1.6%. Values are nanoseconds, up to about 18 minutes.
+#define HIST_SUB_BITS 7
+#define HIST_SUB_BUCKETS ( 1 << HIST_SUB_BITS )
+#define HIST_HALF_BUCKETS ( HIST_SUB_BUCKETS / 2 )
+#define HIST_MAX_SHIFT 34
+#define HIST_BUCKETS ( ( HIST_MAX_SHIFT + 2 ) * HIST_HALF_BUCKETS )
+
+struct Histogram
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+// State of a benchmark connection
+enum ClientState
+{
+    CLIENT_IDLE,        // Waiting for the scheduled time of the next request
+    CLIENT_CONNECTING,  // Nonblocking connect in progress
+    CLIENT_WAITING,     // Request sent, reading the response
+};
+
+struct Worker;
+
+struct Client
+{
+    int socket;
+    enum ClientState state;
+    struct Worker *worker;
+    int commandIndex;       // Next command to send, round robin over the -m list
+    uint64_t scheduled;     // Intended start of the next request
+    uint64_t connectStart;
+    uint64_t queryStart;    // Where the query latency of the current request is measured from
+    uint64_t expires;       // When the pending connect or response times out
+    size_t received;        // Bytes of the current response
+    char lastByte;          // Last byte of the current response
+};
+
+// One thread driving its share of the connections; all counters are private
+// to the thread and only summed after it has stopped
+struct Worker
+{
+    pthread_t thread;
+    int epollFd;
+    struct Client *clients;
+    int clientCount;
+    struct Histogram connectHistogram;
+    struct Histogram queryHistogram;
+    uint64_t requests;
+    uint64_t errors;        // Failed requests, timeouts and unfinished ones included
+    uint64_t timeouts;      // Connects or responses that took longer than -T
+    uint64_t unfinished;    // Connects or responses still pending at the end of the run
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+};
+
+// Settings from the command line, read-only once the workers run
+struct Settings
+{
+    const char *host;
+    const char *port;
+    int connections;
+    int threads;
+    double duration;
+    double rate;                // Requests per second over all connections, 0 = as fast as possible
+    uint64_t timeout;           // Longest wait for a connect or a response, 0 = no limit
+    bool isPerRequest;          // New connection for every request (-x)
+    bool isVerbose;             // Print the full percentile distributions
+    const char *commands[MAX_COMMANDS];
+    size_t commandLengths[MAX_COMMANDS];
+    int commandCount;
+};
+
+struct Settings settings =
+{
+    .host = DEFAULT_HOST,
+    .port = DEFAULT_PORT,
+    .connections = DEFAULT_CONNECTIONS,
+    .threads = DEFAULT_THREADS,
+    .duration = DEFAULT_DURATION_S,
+    .timeout = DEFAULT_TIMEOUT_S * NS_PER_SEC,
+};
+
+struct sockaddr_storage serverAddr;
+socklen_t serverAddrLen;
+
+// Gap between two requests of one connection, 0 in closed-loop mode
+uint64_t requestInterval;
+
+// Time at which the workers stop issuing requests
+uint64_t deadline;
+
+volatile sig_atomic_t exitRequested = 0;
+
+void signalHandler ( int sig )
+{
+    ( void ) sig;
+    exitRequested = 1;
+}
+
+uint64_t nowNs ( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t ) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+int histIndex ( uint64_t value )
+{
+    if ( value < HIST_SUB_BUCKETS )
+    {
+        return ( int ) value;
+    }
+
+    int shift = 63 - __builtin_clzll( value ) - ( HIST_SUB_BITS - 1 );
+    if ( shift > HIST_MAX_SHIFT )
+    {
+        return HIST_BUCKETS - 1;
+    }
+    return ( shift << ( HIST_SUB_BITS - 1 ) ) + ( int ) ( value >> shift );
+}
+
+// Lowest value that lands in a bucket
+uint64_t histValue ( int index )
+{
+    if ( index < HIST_SUB_BUCKETS )
+    {
+        return index;
+    }
+
+    int shift = ( index >> ( HIST_SUB_BITS - 1 ) ) - 1;
+    return ( uint64_t ) ( index - ( shift << ( HIST_SUB_BITS - 1 ) ) ) << shift;
+}
+
+// Highest value that lands in a bucket
+uint64_t histHighest ( int index )
+{
+    return index + 1 < HIST_BUCKETS ? histValue( index + 1 ) - 1 : histValue( index );
+}
+
+void histRecord ( struct Histogram *hist, uint64_t value )
+{
+    hist->counts[histIndex( value )]++;
+    if ( hist->total == 0 || value < hist->min )
+    {
+        hist->min = value;
+    }
+    if ( value > hist->max )
+    {
+        hist->max = value;
+    }
+    hist->total++;
+    hist->sum += value;
+}
+
+void histMerge ( struct Histogram *into, const struct Histogram *from )
+{
+    if ( from->total == 0 )
+    {
+        return;
+    }
+    for ( int i = 0; i < HIST_BUCKETS; i++ )
+    {
+        into->counts[i] += from->counts[i];
+    }
+    if ( into->total == 0 || from->min < into->min )
+    {
+        into->min = from->min;
+    }
+    if ( from->max > into->max )
+    {
+        into->max = from->max;
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+// Value at a percentile, reported as the top of its bucket but never above the maximum
+uint64_t histPercentile ( const struct Histogram *hist, double percentile )
+{
+    uint64_t wanted = ( uint64_t ) ( percentile / 100.0 * hist->total + 0.5 );
+    uint64_t seen = 0;
+
+    if ( wanted < 1 )
+    {
+        wanted = 1;
+    }
+    for ( int i = 0; i < HIST_BUCKETS; i++ )
+    {
+        seen += hist->counts[i];
+        if ( seen >= wanted )
+        {
+            uint64_t value = histHighest( i );
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void histPrint ( const char *name, const struct Histogram *hist )
+{
+    if ( hist->total == 0 )
+    {
+        printf( "%-8s no samples\n", name );
+        return;
+    }
+    printf( "%-8s n=%llu min=%.1f mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n", name,
+            ( unsigned long long ) hist->total, hist->min / 1e3, hist->sum / hist->total / 1e3,
+            histPercentile( hist, 50.0 ) / 1e3, histPercentile( hist, 90.0 ) / 1e3,
+            histPercentile( hist, 99.0 ) / 1e3, histPercentile( hist, 99.9 ) / 1e3, hist->max / 1e3 );
+}
+
+// Percentile distribution in the layout of HdrHistogram's outputPercentileDistribution
+void histPrintDistribution ( const char *name, const struct Histogram *hist )
+{
+    uint64_t seen = 0;
+
+    if ( hist->total == 0 )
+    {
+        return;
+    }
+    printf( "\n%s latency distribution\n", name );
+    printf( "%12s %14s %10s %14s\n\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)" );
+    for ( int i = 0; i < HIST_BUCKETS; i++ )
+    {
+        if ( hist->counts[i] == 0 )
+        {
+            continue;
+        }
+        seen += hist->counts[i];
+
+        double fraction = ( double ) seen / hist->total;
+        uint64_t value = histHighest( i ) < hist->max ? histHighest( i ) : hist->max;
+        if ( seen < hist->total )
+        {
+            printf( "%12.3f %14.12f %10llu %14.2f\n", value / 1e3, fraction,
+                    ( unsigned long long ) seen, 1.0 / ( 1.0 - fraction ) );
+        }
+        else
+        {
+            printf( "%12.3f %14.12f %10llu\n", value / 1e3, fraction, ( unsigned long long ) seen );
+        }
+    }
+    printf( "#[Mean = %.3f, Max = %.3f, Total count = %llu]\n", hist->sum / hist->total / 1e3, hist->max / 1e3,
+            ( unsigned long long ) hist->total );
+}
+
+// Drop the socket of a client and count the failed request
+// The request is retried in its next slot, or after a millisecond in closed-loop
+// mode, so a server that is down is not hammered with connects
+void clientFail ( struct Client *client )
+{
+    uint64_t now = nowNs();
+
+    client->worker->errors++;
+    if ( client->socket != -1 )
+    {
+        close( client->socket );
+        client->socket = -1;
+    }
+    client->state = CLIENT_IDLE;
+
+    if ( requestInterval != 0 && client->scheduled + requestInterval > now )
+    {
+        client->scheduled += requestInterval;
+    }
+    else
+    {
+        client->scheduled = now + ( requestInterval != 0 ? requestInterval : NS_PER_MS );
+    }
+}
+
+// Start a nonblocking connect, completed by clientConnected
+int clientConnect ( struct Client *client, uint64_t now )
+{
+    client->socket = socket( serverAddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if ( client->socket == -1 )
+    {
+        perror( "socket" );
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt( client->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+    client->connectStart = now;
+    client->expires = now + settings.timeout;
+    client->state = CLIENT_CONNECTING;
+    if ( connect( client->socket, ( struct sockaddr * )&serverAddr, serverAddrLen ) == -1 && errno != EINPROGRESS )
+    {
+        clientFail( client );
+        return 0;
+    }
+
+    struct epoll_event event = { .events = EPOLLOUT, .data.ptr = client };
+    if ( epoll_ctl( client->worker->epollFd, EPOLL_CTL_ADD, client->socket, &event ) == -1 )
+    {
+        perror( "epoll_ctl" );
+        return -1;
+    }
+    return 0;
+}
+
+// Send the next command and start timing its response
+void clientSend ( struct Client *client, uint64_t now )
+{
+    const char *command = settings.commands[client->commandIndex];
+    size_t length = settings.commandLengths[client->commandIndex];
+
+    client->commandIndex = ( client->commandIndex + 1 ) % settings.commandCount;
+
+    // Commands are far smaller than the socket buffer, so a short send means trouble
+    if ( send( client->socket, command, length, MSG_NOSIGNAL ) != ( ssize_t ) length )
+    {
+        clientFail( client );
+        return;
+    }
+    if ( settings.isPerRequest )
+    {
+        // Half-close so the server answers and then ends the connection
+        shutdown( client->socket, SHUT_WR );
+    }
+
+    // In open-loop mode a request that starts late has already been waiting,
+    // so the latency is counted from its scheduled time. With -x the wait for
+    // the connection is reported as connect time instead.
+    client->queryStart = requestInterval != 0 && !settings.isPerRequest ? client->scheduled : now;
+    client->expires = now + settings.timeout;
+    client->received = 0;
+    client->lastByte = '\0';
+    client->state = CLIENT_WAITING;
+    client->worker->bytesOut += length;
+}
+
+// The nonblocking connect finished
+void clientConnected ( struct Client *client, uint64_t now )
+{
+    int error = 0;
+    socklen_t errorLen = sizeof( error );
+
+    if ( getsockopt( client->socket, SOL_SOCKET, SO_ERROR, &error, &errorLen ) == -1 || error != 0 )
+    {
+        clientFail( client );
+        return;
+    }
+    histRecord( &client->worker->connectHistogram, now - client->connectStart );
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = client };
+    epoll_ctl( client->worker->epollFd, EPOLL_CTL_MOD, client->socket, &event );
+
+    client->state = CLIENT_IDLE;
+    if ( settings.isPerRequest )
+    {
+        clientSend( client, now );
+    }
+}
+
+// Account for a completed response and schedule the next request
+void clientComplete ( struct Client *client, uint64_t now )
+{
+    struct Worker *worker = client->worker;
+
+    histRecord( &worker->queryHistogram, now - client->queryStart );
+    worker->requests++;
+
+    if ( settings.isPerRequest )
+    {
+        close( client->socket );
+        client->socket = -1;
+    }
+    client->state = CLIENT_IDLE;
+    client->scheduled = requestInterval != 0 ? client->scheduled + requestInterval : now;
+}
+
+// Drain the socket of a client waiting for its response
+// Responses are not framed: with -x a response ends at EOF, otherwise it is
+// complete once it ends on a newline and nothing more is pending. That is exact
+// for get10 and plan, whose answer is a single send; a streamed range or agg
+// response can be split where the server pauses between chunks, so use -x for those.
+void clientReceive ( struct Client *client, char *buffer, size_t size )
+{
+    while ( 1 )
+    {
+        ssize_t bytesReceived = recv( client->socket, buffer, size, 0 );
+        if ( bytesReceived > 0 )
+        {
+            client->received += bytesReceived;
+            client->lastByte = buffer[bytesReceived - 1];
+            client->worker->bytesIn += bytesReceived;
+            continue;
+        }
+        if ( bytesReceived == 0 )
+        {
+            if ( settings.isPerRequest && client->state == CLIENT_WAITING )
+            {
+                clientComplete( client, nowNs() );
+            }
+            else
+            {
+                clientFail( client );
+            }
+            return;
+        }
+        if ( errno == EINTR )
+        {
+            continue;
+        }
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            break;
+        }
+        clientFail( client );
+        return;
+    }
+
+    if ( client->state != CLIENT_WAITING )
+    {
+        // Nothing is expected between requests
+        clientFail( client );
+        return;
+    }
+    if ( !settings.isPerRequest && client->received != 0 && client->lastByte == '\n' )
+    {
+        clientComplete( client, nowNs() );
+    }
+}
+
+// Start every idle request that is due; returns the epoll timeout until the next one
+int workerDispatch ( struct Worker *worker, uint64_t now )
+{
+    uint64_t next = deadline;
+
+    for ( int i = 0; i < worker->clientCount; i++ )
+    {
+        struct Client *client = &worker->clients[i];
+        if ( client->state != CLIENT_IDLE )
+        {
+            if ( settings.timeout == 0 )
+            {
+                continue;
+            }
+            if ( client->expires > now )
+            {
+                if ( client->expires < next )
+                {
+                    next = client->expires;
+                }
+                continue;
+            }
+            // A stalled server is an error, not just a missing sample
+            worker->timeouts++;
+            clientFail( client );
+        }
+
+        if ( client->scheduled <= now )
+        {
+            if ( client->socket == -1 )
+            {
+                // Persistent connections that failed are reopened as well
+                if ( clientConnect( client, now ) == -1 )
+                {
+                    return -1;
+                }
+            }
+            else
+            {
+                clientSend( client, now );
+            }
+            if ( client->state != CLIENT_IDLE )
+            {
+                if ( settings.timeout != 0 && client->expires < next )
+                {
+                    next = client->expires;
+                }
+                continue;
+            }
+        }
+        if ( client->scheduled < next )
+        {
+            next = client->scheduled;
+        }
+    }
+
+    if ( next <= now )
+    {
+        return 0;
+    }
+    return ( int ) ( ( next - now + NS_PER_MS - 1 ) / NS_PER_MS );
+}
+
+void *workerLoop ( void *arg )
+{
+    struct Worker *worker = ( struct Worker * ) arg;
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    char buffer[RECV_BUFFER_SIZE];
+    uint64_t now = nowNs();
+
+    // Persistent connections are set up before the clock for the first request starts
+    if ( !settings.isPerRequest )
+    {
+        for ( int i = 0; i < worker->clientCount; i++ )
+        {
+            if ( clientConnect( &worker->clients[i], now ) == -1 )
+            {
+                return NULL;
+            }
+        }
+    }
+
+    while ( !exitRequested && ( now = nowNs() ) < deadline )
+    {
+        int timeout = workerDispatch( worker, now );
+        if ( timeout == -1 )
+        {
+            break;
+        }
+
+        int eventCount = epoll_wait( worker->epollFd, events, BENCH_MAX_EVENTS, timeout );
+        if ( eventCount == -1 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            perror( "epoll_wait" );
+            break;
+        }
+
+        now = nowNs();
+        for ( int i = 0; i < eventCount; i++ )
+        {
+            struct Client *client = events[i].data.ptr;
+            if ( client->state == CLIENT_CONNECTING )
+            {
+                clientConnected( client, now );
+            }
+            else
+            {
+                clientReceive( client, buffer, sizeof( buffer ) );
+            }
+        }
+    }
+
+    // Requests still in flight at the deadline never completed, so they count as errors
+    for ( int i = 0; i < worker->clientCount; i++ )
+    {
+        if ( worker->clients[i].state != CLIENT_IDLE )
+        {
+            worker->unfinished++;
+            worker->errors++;
+        }
+        if ( worker->clients[i].socket != -1 )
+        {
+            close( worker->clients[i].socket );
+        }
+    }
+    return NULL;
+}
+
+int resolveServer ( void )
+{
+    struct addrinfo hints, *result;
+
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int status = getaddrinfo( settings.host, settings.port, &hints, &result );
+    if ( status != 0 )
+    {
+        fprintf( stderr, "Failed to resolve %s:%s: %s\n", settings.host, settings.port, gai_strerror( status ) );
+        return -1;
+    }
+    memcpy( &serverAddr, result->ai_addr, result->ai_addrlen );
+    serverAddrLen = result->ai_addrlen;
+    freeaddrinfo( result );
+    return 0;
+}
+
+void usage ( const char *prog )
+{
+    fprintf( stderr,
+             "Usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds] [-r rate] [-m command]...\n"
+             "          [-T seconds] [-x] [-v]\n"
+             "  -h  server address (default %s)\n"
+             "  -p  server port (default %s)\n"
+             "  -c  concurrent connections (default %d)\n"
+             "  -t  threads driving the connections (default %d)\n"
+             "  -d  test duration in seconds (default %d)\n"
+             "  -r  target requests per second over all connections; query latency on persistent\n"
+             "      connections is then measured from each request's scheduled time\n"
+             "      (default: as fast as possible)\n"
+             "  -m  command to send, repeat to rotate through several (default %s)\n"
+             "  -T  longest wait for a connect or a response before it counts as an error,\n"
+             "      0 = no limit (default %d)\n"
+             "  -x  open a new connection for every request and read the response until EOF\n"
+             "  -v  print the full latency distributions\n",
+             prog, DEFAULT_HOST, DEFAULT_PORT, DEFAULT_CONNECTIONS, DEFAULT_THREADS, DEFAULT_DURATION_S,
+             DEFAULT_COMMAND, DEFAULT_TIMEOUT_S );
+}
+
+int main ( int argc, char *argv[] )
+{
+    int option;
+    while ( ( option = getopt( argc, argv, "h:p:c:t:d:r:m:T:xv" ) ) != -1 )
+    {
+        switch ( option )
+        {
+            case 'h':
+                settings.host = optarg;
+                break;
+            case 'p':
+                settings.port = optarg;
+                break;
+            case 'c':
+                settings.connections = atoi( optarg );
+                break;
+            case 't':
+                settings.threads = atoi( optarg );
+                break;
+            case 'd':
+                settings.duration = atof( optarg );
+                break;
+            case 'r':
+                settings.rate = atof( optarg );
+                break;
+            case 'm':
+                if ( settings.commandCount == MAX_COMMANDS || optarg[0] == '\0' )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                settings.commands[settings.commandCount++] = optarg;
+                break;
+            case 'T':
+                if ( atof( optarg ) < 0 )
+                {
+                    usage( argv[0] );
+                    return 1;
+                }
+                settings.timeout = ( uint64_t ) ( atof( optarg ) * NS_PER_SEC );
+                break;
+            case 'x':
+                settings.isPerRequest = true;
+                break;
+            case 'v':
+                settings.isVerbose = true;
+                break;
+            default:
+                usage( argv[0] );
+                return 1;
+        }
+    }
+    if ( settings.connections < 1 || settings.threads < 1 || settings.duration <= 0 || settings.rate < 0 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+    if ( settings.threads > settings.connections )
+    {
+        settings.threads = settings.connections;
+    }
+    if ( settings.commandCount == 0 )
+    {
+        settings.commands[settings.commandCount++] = DEFAULT_COMMAND;
+    }
+    for ( int i = 0; i < settings.commandCount; i++ )
+    {
+        settings.commandLengths[i] = strlen( settings.commands[i] );
+    }
+
+    if ( resolveServer() == -1 )
+    {
+        return 1;
+    }
+
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = signalHandler;
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+
+    struct Worker *workers = calloc( settings.threads, sizeof( struct Worker ) );
+    struct Client *clients = calloc( settings.connections, sizeof( struct Client ) );
+    if ( workers == NULL || clients == NULL )
+    {
+        fprintf( stderr, "Failed to allocate memory\n" );
+        return 1;
+    }
+
+    // Each connection gets an equal share of the rate; their first requests are
+    // staggered over one interval so they do not arrive in lockstep
+    requestInterval = settings.rate > 0 ? ( uint64_t ) ( settings.connections * NS_PER_SEC / settings.rate ) : 0;
+    uint64_t start = nowNs();
+    deadline = start + ( uint64_t ) ( settings.duration * NS_PER_SEC );
+
+    // Worker w drives the contiguous slice of connections starting at w * connections / threads
+    for ( int w = 0; w < settings.threads; w++ )
+    {
+        int first = w * settings.connections / settings.threads;
+        int end = ( w + 1 ) * settings.connections / settings.threads;
+
+        workers[w].clients = &clients[first];
+        workers[w].clientCount = end - first;
+        for ( int i = first; i < end; i++ )
+        {
+            clients[i].socket = -1;
+            clients[i].state = CLIENT_IDLE;
+            clients[i].worker = &workers[w];
+            clients[i].scheduled = start + requestInterval * i / settings.connections;
+        }
+    }
+
+    int started = 0;
+    for ( ; started < settings.threads; started++ )
+    {
+        workers[started].epollFd = epoll_create1( EPOLL_CLOEXEC );
+        if ( workers[started].epollFd == -1 ||
+             pthread_create( &workers[started].thread, NULL, workerLoop, &workers[started] ) != 0 )
+        {
+            perror( "Failed to start worker" );
+            exitRequested = 1;
+            break;
+        }
+    }
+
+    struct Worker total;
+    memset( &total, 0, sizeof( total ) );
+    for ( int w = 0; w < started; w++ )
+    {
+        pthread_join( workers[w].thread, NULL );
+        close( workers[w].epollFd );
+
+        histMerge( &total.connectHistogram, &workers[w].connectHistogram );
+        histMerge( &total.queryHistogram, &workers[w].queryHistogram );
+        total.requests += workers[w].requests;
+        total.errors += workers[w].errors;
+        total.timeouts += workers[w].timeouts;
+        total.unfinished += workers[w].unfinished;
+        total.bytesIn += workers[w].bytesIn;
+        total.bytesOut += workers[w].bytesOut;
+    }
+    double elapsed = ( nowNs() - start ) / ( double ) NS_PER_SEC;
+
+    printf( "%d connections on %d threads, %s, %.1f s\n", settings.connections, settings.threads,
+            settings.isPerRequest ? "new connection per request" : "persistent connections", elapsed );
+    printf( "requests %llu (%.1f/s), errors %llu (timed out %llu, unfinished %llu), in %.1f KiB/s, out %.1f KiB/s\n",
+            ( unsigned long long ) total.requests, total.requests / elapsed, ( unsigned long long ) total.errors,
+            ( unsigned long long ) total.timeouts, ( unsigned long long ) total.unfinished,
+            total.bytesIn / elapsed / 1024, total.bytesOut / elapsed / 1024 );
+    histPrint( "connect", &total.connectHistogram );
+    histPrint( "query", &total.queryHistogram );
+    if ( settings.isVerbose )
+    {
+        histPrintDistribution( "connect", &total.connectHistogram );
+        histPrintDistribution( "query", &total.queryHistogram );
+    }
+
+    free( clients );
+    free( workers );
+    return total.requests == 0 ? 1 : 0;
+}
@@ -6,6 +6,7 @@
  *              with sys/log logging.
  */
 
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,12 +20,16 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <pthread.h>
 #include <time.h>
 #include "queue.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
 #include "sqlite3.h"
 
 #define USE_AESD_CHAR_DEVICE 1
@@ -36,213 +41,2132 @@
     #define DATA_FILE "/var/tmp/aesdsocketdata"
 #endif
 
-// Declare global variables for the socket file descriptor and file pointer
+// Declare global variable for the socket file descriptor
 int serverSocket;
-FILE *filePointer;
-int fd;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Serializes writers of DATA_FILE; readers only exclude writers, never each other
+pthread_rwlock_t dataFileLock = PTHREAD_RWLOCK_INITIALIZER;
 pthread_t timestampThread;
 
-#define DATABASE_FILE "finalProject.db"
-sqlite3 *db;
+#define DATABASE_FILE "finalProject.db"
+
+// Setup connection of the main thread; it switches the database to WAL and
+// keeps it open, while queries run on per-thread read connections
+sqlite3 *db;
+
+// How long a reader waits on a locked database before giving up
+#define DB_BUSY_TIMEOUT_MS 1000
+
+// Queries served from the per-thread statement cache
+enum QueryId
+{
+    QUERY_LAST_10,
+    QUERY_RANGE,
+    QUERY_BUCKET_AVG,
+    QUERY_BUCKET_MIN,
+    QUERY_BUCKET_MAX,
+    QUERY_COUNT
+};
+
+// SQL text of each cached query, parsed once per thread
+static const char *querySql[QUERY_COUNT] =
+{
+    [QUERY_LAST_10] = "SELECT timestamp, temperature, humidity, pressure FROM sensor_data "
+                      "ORDER BY timestamp DESC, rowid DESC LIMIT 10;",
+    [QUERY_RANGE] = "SELECT timestamp, temperature, humidity, pressure FROM sensor_data "
+                    "WHERE timestamp BETWEEN ?1 AND ?2 ORDER BY timestamp LIMIT ?3;",
+    // ?3 equal-width time buckets over [?1, ?2], bucket index in column 4
+    [QUERY_BUCKET_AVG] = "SELECT CAST( AVG( timestamp ) AS INTEGER ), AVG( temperature ), AVG( humidity ), "
+                         "AVG( pressure ), ( ( timestamp - ?1 ) * ?3 ) / ( ?2 - ?1 + 1 ) AS bucket "
+                         "FROM sensor_data WHERE timestamp BETWEEN ?1 AND ?2 GROUP BY bucket ORDER BY bucket;",
+    // The sample holding the extreme of series ?4 (1 temperature, 2 humidity, 3 pressure) in
+    // each bucket: with a single min() or max(), SQLite takes the bare columns from that row
+    [QUERY_BUCKET_MIN] = "SELECT timestamp, temperature, humidity, pressure, "
+                         "( ( timestamp - ?1 ) * ?3 ) / ( ?2 - ?1 + 1 ) AS bucket, "
+                         "MIN( CASE ?4 WHEN 2 THEN humidity WHEN 3 THEN pressure ELSE temperature END ) "
+                         "FROM sensor_data WHERE timestamp BETWEEN ?1 AND ?2 GROUP BY bucket ORDER BY bucket;",
+    [QUERY_BUCKET_MAX] = "SELECT timestamp, temperature, humidity, pressure, "
+                         "( ( timestamp - ?1 ) * ?3 ) / ( ?2 - ?1 + 1 ) AS bucket, "
+                         "MAX( CASE ?4 WHEN 2 THEN humidity WHEN 3 THEN pressure ELSE temperature END ) "
+                         "FROM sensor_data WHERE timestamp BETWEEN ?1 AND ?2 GROUP BY bucket ORDER BY bucket;",
+};
+
+// One sensor_data row
+struct Sample
+{
+    sqlite3_int64 timestamp;
+    double temperature;
+    double humidity;
+    double pressure;
+};
+
+// Number of recent samples kept in memory, a power of two
+#define SAMPLE_RING_CAPACITY 256
+
+// Number of samples returned by get10
+#define GET10_COUNT 10
+
+// Samples with the newest timestamps, oldest first, so get10 never has to touch
+// SQLite. Equal timestamps stay in rowid order, matching QUERY_LAST_10.
+struct SampleRing
+{
+    pthread_rwlock_t lock;
+    struct Sample samples[SAMPLE_RING_CAPACITY];
+    unsigned int start;         // Slot of the oldest sample
+    unsigned int size;          // Samples held, up to SAMPLE_RING_CAPACITY
+    bool isWarm;                // Loaded from the database, until then get10 queries SQLite
+};
+
+#define RING_SLOT( i ) ( ( sampleRing.start + ( i ) ) % SAMPLE_RING_CAPACITY )
+
+struct SampleRing sampleRing = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+// Largest number of points a downsampling query may ask for
+#define MAX_DOWNSAMPLE_POINTS 4096
+
+// Progress of a largest-triangle-three-buckets query
+struct Lttb
+{
+    long long fromTs;
+    long long toTs;
+    int points;                 // Number of equal-width time buckets
+    int series;                 // Column the points are picked on: 1 temperature, 2 humidity, 3 pressure
+    double *avgTime;            // Per-bucket average timestamp, from the first pass
+    double *avgValue;           // Per-bucket average of the series, from the first pass
+    int *nextBucket;            // Next non-empty bucket after each bucket, or -1
+    int firstBucket;
+    int lastBucket;
+    int currentBucket;          // Bucket of the rows being scanned in the second pass
+    struct Sample selected;     // Point kept for the previous bucket
+    struct Sample best;         // Best candidate of the current bucket
+    double bestArea;
+};
+
+// Names of the cached queries, as reported by the plan command
+static const char *queryName[QUERY_COUNT] =
+{
+    [QUERY_LAST_10] = "last10",
+    [QUERY_RANGE] = "range",
+    [QUERY_BUCKET_AVG] = "bucket_avg",
+    [QUERY_BUCKET_MIN] = "bucket_min",
+    [QUERY_BUCKET_MAX] = "bucket_max",
+};
+
+// Read connection and prepared statements owned by one thread, reset and rebound between uses
+struct StatementCache
+{
+    sqlite3 *db;
+    sqlite3_stmt *stmts[QUERY_COUNT];
+    bool inUse[QUERY_COUNT];
+};
+
+// Key to each thread's StatementCache, finalized when the thread exits
+pthread_key_t statementCacheKey;
+
+// Size of the buffer used to render the get10 response
+#define GET10_BUFFER_SIZE 1536
+
+// Size of the per-connection receive buffer
+#define RECV_BUFFER_SIZE 1024
+
+// Streamed query results are produced this many bytes at a time
+#define STREAM_CHUNK_SIZE 16384
+
+// Upper bound on the length of one formatted row
+#define ROW_BUFFER_SIZE 256
+
+// Reactor (epoll) mode settings
+#define REACTOR_MAX_EVENTS 64
+#define DEFAULT_REACTOR_THREADS 1
+
+// How often the sample feed checks the database for new rows
+#define FEED_POLL_INTERVAL_MS 100
+#define FEED_MAX_EVENTS 32
+
+// Worker pool settings. The pool is opt-in (-w N): a worker belongs to one
+// connection for its whole life, so it caps how many clients are served at
+// once, while the default thread per connection serves every client
+#define DEFAULT_QUEUE_DEPTH 64
+// A pool worker belongs to one connection until it closes, so a client that
+// neither sends a command nor takes its response for this long is dropped
+// to free the worker for the queue
+#define POOL_IDLE_TIMEOUT_S 30
+// How often a full queue rechecks the exit flag, which the signal handler
+// sets without the pool lock
+#define POOL_SUBMIT_WAKE_MS 100
+
+// Run the epoll reactor instead of the worker pool (-e)
+bool isReactorMode = false;
+
+// Number of reactor or pool threads (-w), -1 selects the default for the mode
+// Without -e, 0 or no -w at all means one thread per connection
+int workerCount = -1;
+
+// Number of accepted sockets the pool queues before accept() waits (-q)
+int queueDepth = DEFAULT_QUEUE_DEPTH;
+
+// Set by the signal handler, checked by the main thread
+volatile sig_atomic_t exitRequested = 0;
+
+// Latency histograms count into power-of-two buckets: bucket i holds values up
+// to 2^i microseconds, the last one everything longer
+#define METRIC_BUCKETS 24
+
+// Commands whose latency is tracked, anything unrecognized is echoed
+enum MetricCommand
+{
+    COMMAND_GET10,
+    COMMAND_RANGE,
+    COMMAND_AGG,
+    COMMAND_PLAN,
+    COMMAND_SUBSCRIBE,
+    COMMAND_STATS,
+    COMMAND_ECHO,
+    COMMAND_COUNT
+};
+
+static const char *commandName[COMMAND_COUNT] =
+{
+    [COMMAND_GET10] = "get10",
+    [COMMAND_RANGE] = "range",
+    [COMMAND_AGG] = "agg",
+    [COMMAND_PLAN] = "plan",
+    [COMMAND_SUBSCRIBE] = "subscribe",
+    [COMMAND_STATS] = "stats",
+    [COMMAND_ECHO] = "echo",
+};
+
+// Locks whose wait time is tracked
+enum MetricLock
+{
+    LOCK_DATA_FILE,
+    LOCK_SAMPLE_RING,
+    LOCK_WORKER_POOL,
+    LOCK_SAMPLE_FEED,
+    LOCK_COUNT
+};
+
+static const char *lockName[LOCK_COUNT] =
+{
+    [LOCK_DATA_FILE] = "data_file",
+    [LOCK_SAMPLE_RING] = "sample_ring",
+    [LOCK_WORKER_POOL] = "worker_pool",
+    [LOCK_SAMPLE_FEED] = "sample_feed",
+};
+
+// What a thread is for, reported by the thread gauge
+enum ThreadRole
+{
+    ROLE_MAIN,
+    ROLE_POOL,
+    ROLE_REACTOR,
+    ROLE_CONNECTION,
+    ROLE_FEED,
+    ROLE_TIMESTAMP,
+    ROLE_COUNT
+};
+
+static const char *roleName[ROLE_COUNT] =
+{
+    [ROLE_MAIN] = "main",
+    [ROLE_POOL] = "pool",
+    [ROLE_REACTOR] = "reactor",
+    [ROLE_CONNECTION] = "connection",
+    [ROLE_FEED] = "feed",
+    [ROLE_TIMESTAMP] = "timestamp",
+};
+
+struct LatencyHistogram
+{
+    uint64_t buckets[METRIC_BUCKETS];
+    uint64_t count;
+    uint64_t sumNs;
+};
+
+// Counters of one thread. Only the owning thread writes them, so the hot path
+// needs no lock and no locked instruction; the stats command reads them with
+// relaxed atomic loads.
+struct ThreadMetrics
+{
+    enum ThreadRole role;
+    uint64_t accepts;
+    uint64_t opened;            // Connections set up by this thread
+    uint64_t closed;            // Connections closed by this thread
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    struct LatencyHistogram commands[COMMAND_COUNT];
+    struct LatencyHistogram sqliteStep;
+    struct LatencyHistogram lockWait[LOCK_COUNT];
+    LIST_ENTRY( ThreadMetrics ) entries;
+};
+
+// Every live thread's counters, plus the totals of threads that have exited
+// The lock is only taken when a thread starts or exits and by the stats command
+struct MetricsRegistry
+{
+    pthread_mutex_t lock;
+    LIST_HEAD( ThreadMetricsHead, ThreadMetrics ) threads;
+    struct ThreadMetrics retired;
+    uint64_t startedNs;
+};
+
+struct MetricsRegistry metricsRegistry = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Key to each thread's ThreadMetrics, retired when the thread exits
+pthread_key_t metricsKey;
+
+// State of a connection
+enum ConnState
+{
+    CONN_READING,   // Receiving commands until the client shuts down its side
+    CONN_DUMPING,   // Streaming the content of DATA_FILE back to the client
+    CONN_SUBSCRIBED,    // Waiting to be handed to the sample feed
+};
+
+// Per-connection context, shared by the blocking workers and the reactor
+struct Connection
+{
+    int clientSocket;
+    int dataFd;
+    enum ConnState state;
+    char ipAddress[INET_ADDRSTRLEN];
+    char *outBuffer;        // Pending output not yet accepted by the socket
+    size_t outLen;          // Number of bytes queued in outBuffer
+    size_t outSent;         // Number of queued bytes already sent
+    size_t outCapacity;     // Allocated size of outBuffer
+    sqlite3_stmt *cursor;   // Query being streamed to the client, or NULL
+    enum QueryId cursorQuery;
+    int ( *produce )( struct Connection *conn );   // Generates the next chunk of a streamed response
+    struct Lttb *lttb;      // Downsampling state, only while an lttb query runs
+    enum MetricCommand command;     // Command being served
+    uint64_t commandStart;          // When it was received
+};
+
+// Structure to hold thread information
+struct ThreadInfo
+{
+    pthread_t threadId;
+    int clientSocket;
+    bool threadComplete;
+    SLIST_ENTRY( ThreadInfo ) entries;
+};
+
+// Declare the head of the singly linked list
+SLIST_HEAD( ThreadHead, ThreadInfo ) threadHead;
+
+// Accepted socket waiting for a pool worker
+struct Job
+{
+    int clientSocket;
+    STAILQ_ENTRY( Job ) entries;
+};
+
+STAILQ_HEAD( JobHead, Job );
+
+// Fixed-size worker pool fed by a bounded queue of accepted sockets
+struct WorkerPool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    struct JobHead pending;     // Sockets waiting for a worker, oldest first
+    struct JobHead freeJobs;    // Preallocated nodes so the accept path never allocates
+    struct Job *jobs;
+    pthread_t *threads;
+    int *serving;               // Socket each worker is serving, -1 when idle
+    int threadCount;
+    int slotCount;              // Workers that have claimed a serving slot
+    bool stopping;
+};
+
+struct WorkerPool workerPool;
+
+// Client that receives every new sample as soon as it is stored
+struct Subscriber
+{
+    int clientSocket;
+    char ipAddress[INET_ADDRSTRLEN];
+    LIST_ENTRY( Subscriber ) entries;
+};
+
+// Thread that watches sensor_data for new rows, keeps the sample ring
+// current and pushes the rows to subscribers
+struct SampleFeed
+{
+    pthread_t thread;
+    int epollFd;                // Subscriber sockets, only watched for hangups
+    pthread_mutex_t lock;       // Protects subscribers
+    LIST_HEAD( SubscriberHead, Subscriber ) subscribers;
+    sqlite3 *db;                // Private read connection of the feed thread
+    sqlite3_stmt *versionStmt;
+    sqlite3_stmt *newRowsStmt;
+    sqlite3_int64 lastRowid;    // Newest row already delivered
+    int subscriberCount;
+};
+
+struct SampleFeed sampleFeed;
+
+// Signal handler function to catch SIGINT and SIGTERM signals
+void signalHandler ( int sig )
+{
+    // Check if the signal is SIGINT or SIGTERM
+    if ( sig == SIGINT || sig == SIGTERM )
+    {
+        exitRequested = 1;
+
+        // Wake the main thread out of accept()
+        if ( serverSocket != -1 )
+        {
+            shutdown( serverSocket, SHUT_RDWR );
+        }
+    }
+}
+
+// Create a thread with SIGINT/SIGTERM blocked so they are always delivered to the main thread
+int startThread ( pthread_t *thread, void *( *routine )( void * ), void *arg )
+{
+    sigset_t blocked, previous;
+    sigemptyset( &blocked );
+    sigaddset( &blocked, SIGINT );
+    sigaddset( &blocked, SIGTERM );
+
+    pthread_sigmask( SIG_BLOCK, &blocked, &previous );
+    int result = pthread_create( thread, NULL, routine, arg );
+    pthread_sigmask( SIG_SETMASK, &previous, NULL );
+    return result;
+}
+
+// Monotonic clock in nanoseconds, for latency measurements
+uint64_t metricsNow ( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return ( uint64_t ) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Update a counter of the calling thread; it is the only writer
+static inline void metricAdd ( uint64_t *counter, uint64_t value )
+{
+    __atomic_store_n( counter, __atomic_load_n( counter, __ATOMIC_RELAXED ) + value, __ATOMIC_RELAXED );
+}
+
+static inline uint64_t metricRead ( const uint64_t *counter )
+{
+    return __atomic_load_n( counter, __ATOMIC_RELAXED );
+}
+
+// Register the calling thread's counters
+struct ThreadMetrics *metricsThreadStart ( enum ThreadRole role )
+{
+    static struct ThreadMetrics discarded;
+    struct ThreadMetrics *metrics = calloc( 1, sizeof( struct ThreadMetrics ) );
+    if ( metrics == NULL )
+    {
+        // Keep the thread going; what it counts is simply lost
+        syslog( LOG_ERR, "Failed to allocate memory" );
+        return &discarded;
+    }
+    metrics->role = role;
+
+    pthread_mutex_lock( &metricsRegistry.lock );
+    LIST_INSERT_HEAD( &metricsRegistry.threads, metrics, entries );
+    pthread_mutex_unlock( &metricsRegistry.lock );
+    pthread_setspecific( metricsKey, metrics );
+    return metrics;
+}
+
+// Calling thread's counters; a thread that did not register is counted as main
+struct ThreadMetrics *threadMetrics ( void )
+{
+    struct ThreadMetrics *metrics = pthread_getspecific( metricsKey );
+    if ( metrics == NULL )
+    {
+        metrics = metricsThreadStart( ROLE_MAIN );
+    }
+    return metrics;
+}
+
+void histogramAdd ( struct LatencyHistogram *into, const struct LatencyHistogram *from )
+{
+    for ( int i = 0; i < METRIC_BUCKETS; i++ )
+    {
+        into->buckets[i] += metricRead( &from->buckets[i] );
+    }
+    into->count += metricRead( &from->count );
+    into->sumNs += metricRead( &from->sumNs );
+}
+
+// Add one thread's counters to a total; called with the registry lock held
+void metricsAdd ( struct ThreadMetrics *into, const struct ThreadMetrics *from )
+{
+    into->accepts += metricRead( &from->accepts );
+    into->opened += metricRead( &from->opened );
+    into->closed += metricRead( &from->closed );
+    into->bytesIn += metricRead( &from->bytesIn );
+    into->bytesOut += metricRead( &from->bytesOut );
+    for ( int i = 0; i < COMMAND_COUNT; i++ )
+    {
+        histogramAdd( &into->commands[i], &from->commands[i] );
+    }
+    histogramAdd( &into->sqliteStep, &from->sqliteStep );
+    for ( int i = 0; i < LOCK_COUNT; i++ )
+    {
+        histogramAdd( &into->lockWait[i], &from->lockWait[i] );
+    }
+}
+
+// Fold the counters of a thread that is exiting into the retired totals
+void metricsThreadExit ( void *arg )
+{
+    struct ThreadMetrics *metrics = ( struct ThreadMetrics * ) arg;
+
+    pthread_mutex_lock( &metricsRegistry.lock );
+    metricsAdd( &metricsRegistry.retired, metrics );
+    LIST_REMOVE( metrics, entries );
+    pthread_mutex_unlock( &metricsRegistry.lock );
+    free( metrics );
+}
+
+void histogramRecord ( struct LatencyHistogram *histogram, uint64_t ns )
+{
+    // Round up, so a value is never counted below its bucket's le bound
+    uint64_t us = ( ns + 999 ) / 1000;
+    int bucket = us <= 1 ? 0 : 64 - __builtin_clzll( us - 1 );
+
+    if ( bucket >= METRIC_BUCKETS )
+    {
+        bucket = METRIC_BUCKETS - 1;
+    }
+    metricAdd( &histogram->buckets[bucket], 1 );
+    metricAdd( &histogram->count, 1 );
+    metricAdd( &histogram->sumNs, ns );
+}
+
+// Lock helpers that record how long the caller waited
+// An uncontended lock is taken with a single try and no clock reads
+void lockMutex ( pthread_mutex_t *mutex, enum MetricLock id )
+{
+    uint64_t waited = 0;
+    if ( pthread_mutex_trylock( mutex ) != 0 )
+    {
+        uint64_t start = metricsNow();
+        pthread_mutex_lock( mutex );
+        waited = metricsNow() - start;
+    }
+    histogramRecord( &threadMetrics()->lockWait[id], waited );
+}
+
+void lockRead ( pthread_rwlock_t *rwlock, enum MetricLock id )
+{
+    uint64_t waited = 0;
+    if ( pthread_rwlock_tryrdlock( rwlock ) != 0 )
+    {
+        uint64_t start = metricsNow();
+        pthread_rwlock_rdlock( rwlock );
+        waited = metricsNow() - start;
+    }
+    histogramRecord( &threadMetrics()->lockWait[id], waited );
+}
+
+void lockWrite ( pthread_rwlock_t *rwlock, enum MetricLock id )
+{
+    uint64_t waited = 0;
+    if ( pthread_rwlock_trywrlock( rwlock ) != 0 )
+    {
+        uint64_t start = metricsNow();
+        pthread_rwlock_wrlock( rwlock );
+        waited = metricsNow() - start;
+    }
+    histogramRecord( &threadMetrics()->lockWait[id], waited );
+}
+
+// sqlite3_step, timed
+int stepTimed ( sqlite3_stmt *stmt )
+{
+    uint64_t start = metricsNow();
+    int result = sqlite3_step( stmt );
+    histogramRecord( &threadMetrics()->sqliteStep, metricsNow() - start );
+    return result;
+}
+
+// Finalize the statements of a thread that is exiting and close its connection
+void stmtCacheDestroy ( void *arg )
+{
+    struct StatementCache *cache = ( struct StatementCache * ) arg;
+
+    for ( int i = 0; i < QUERY_COUNT; i++ )
+    {
+        sqlite3_finalize( cache->stmts[i] );
+    }
+    sqlite3_close( cache->db );
+    free( cache );
+}
+
+// Get the calling thread's cache, opening its read-only connection on first use
+// Only this thread ever touches the connection, so SQLite's own mutex is skipped
+struct StatementCache *stmtCache ( void )
+{
+    struct StatementCache *cache = pthread_getspecific( statementCacheKey );
+
+    if ( cache == NULL )
+    {
+        cache = calloc( 1, sizeof( struct StatementCache ) );
+        if ( cache == NULL )
+        {
+            syslog( LOG_ERR, "Failed to allocate memory" );
+            return NULL;
+        }
+        if ( sqlite3_open_v2( DATABASE_FILE, &cache->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                              NULL ) != SQLITE_OK )
+        {
+            syslog( LOG_ERR, "Can't open database: %s", sqlite3_errmsg( cache->db ) );
+            sqlite3_close( cache->db );
+            free( cache );
+            return NULL;
+        }
+        sqlite3_busy_timeout( cache->db, DB_BUSY_TIMEOUT_MS );
+        pthread_setspecific( statementCacheKey, cache );
+    }
+    return cache;
+}
+
+// Get a ready-to-bind statement for a query from the calling thread's cache
+// If the cached statement is still in use (a reactor thread interleaving
+// connections), a one-off statement is prepared instead
+sqlite3_stmt *stmtAcquire ( enum QueryId id )
+{
+    struct StatementCache *cache = stmtCache();
+    sqlite3_stmt *stmt;
+
+    if ( cache == NULL )
+    {
+        return NULL;
+    }
+
+    if ( cache->inUse[id] )
+    {
+        if ( sqlite3_prepare_v2( cache->db, querySql[id], -1, &stmt, NULL ) != SQLITE_OK )
+        {
+            syslog( LOG_ERR, "SQL error: %s", sqlite3_errmsg( cache->db ) );
+            return NULL;
+        }
+        return stmt;
+    }
+
+    if ( cache->stmts[id] == NULL &&
+         sqlite3_prepare_v3( cache->db, querySql[id], -1, SQLITE_PREPARE_PERSISTENT, &cache->stmts[id], NULL ) != SQLITE_OK )
+    {
+        syslog( LOG_ERR, "SQL error: %s", sqlite3_errmsg( cache->db ) );
+        cache->stmts[id] = NULL;
+        return NULL;
+    }
+    cache->inUse[id] = true;
+    return cache->stmts[id];
+}
+
+// Give a statement back; cached ones are reset right away so they release their read lock
+void stmtRelease ( enum QueryId id, sqlite3_stmt *stmt )
+{
+    struct StatementCache *cache = pthread_getspecific( statementCacheKey );
+
+    if ( cache != NULL && cache->stmts[id] == stmt )
+    {
+        sqlite3_reset( stmt );
+        sqlite3_clear_bindings( stmt );
+        cache->inUse[id] = false;
+        return;
+    }
+    sqlite3_finalize( stmt );
+}
+
+// Format the current row of a sensor_data query as one line of text
+// Returns the number of characters that would have been written, like snprintf
+int formatRow ( sqlite3_stmt *stmt, char *buffer, size_t size )
+{
+    return snprintf( buffer, size, "Timestamp: %s, Temperature: %s, Humidity: %s, Pressure: %s\n",
+                     sqlite3_column_text( stmt, 0 ), sqlite3_column_text( stmt, 1 ),
+                     sqlite3_column_text( stmt, 2 ), sqlite3_column_text( stmt, 3 ) );
+}
+
+// Read the current row of a sensor_data query
+void readSample ( sqlite3_stmt *stmt, struct Sample *sample )
+{
+    sample->timestamp = sqlite3_column_int64( stmt, 0 );
+    sample->temperature = sqlite3_column_double( stmt, 1 );
+    sample->humidity = sqlite3_column_double( stmt, 2 );
+    sample->pressure = sqlite3_column_double( stmt, 3 );
+}
+
+// Format a sample the same way formatRow renders it straight from SQLite
+int formatSample ( const struct Sample *sample, char *buffer, size_t size )
+{
+    sqlite3_snprintf( size, buffer, "Timestamp: %lld, Temperature: %!.15g, Humidity: %!.15g, Pressure: %!.15g\n",
+                      sample->timestamp, sample->temperature, sample->humidity, sample->pressure );
+    return strlen( buffer );
+}
+
+// Add a newly stored sample to the ring, evicting the oldest one when full
+// Samples with equal timestamps must arrive in rowid order. Live samples are
+// normally the latest and just get appended; a replayed older one is moved
+// into place or dropped.
+void ringPush ( const struct Sample *sample )
+{
+    lockWrite( &sampleRing.lock, LOCK_SAMPLE_RING );
+    if ( sampleRing.size == SAMPLE_RING_CAPACITY )
+    {
+        if ( sample->timestamp < sampleRing.samples[sampleRing.start].timestamp )
+        {
+            // Older than everything held, so it can never be among the latest
+            pthread_rwlock_unlock( &sampleRing.lock );
+            return;
+        }
+        sampleRing.start = RING_SLOT( 1 );
+        sampleRing.size--;
+    }
+
+    unsigned int position = sampleRing.size;
+    while ( position > 0 && sampleRing.samples[RING_SLOT( position - 1 )].timestamp > sample->timestamp )
+    {
+        sampleRing.samples[RING_SLOT( position )] = sampleRing.samples[RING_SLOT( position - 1 )];
+        position--;
+    }
+    sampleRing.samples[RING_SLOT( position )] = *sample;
+    sampleRing.size++;
+    pthread_rwlock_unlock( &sampleRing.lock );
+}
+
+// Render the newest samples of the ring, newest first
+// Returns the number of bytes written, or -1 if the ring is not loaded yet
+int ringFormatLatest ( char *buffer, size_t size )
+{
+    struct Sample latest[GET10_COUNT];
+    int sampleCount = 0;
+
+    // Copy under the lock, format outside of it
+    lockRead( &sampleRing.lock, LOCK_SAMPLE_RING );
+    if ( !sampleRing.isWarm )
+    {
+        pthread_rwlock_unlock( &sampleRing.lock );
+        return -1;
+    }
+    for ( unsigned int i = sampleRing.size; i > 0 && sampleCount < GET10_COUNT; i-- )
+    {
+        latest[sampleCount++] = sampleRing.samples[RING_SLOT( i - 1 )];
+    }
+    pthread_rwlock_unlock( &sampleRing.lock );
+
+    size_t bufferPos = 0;
+    buffer[0] = '\0';
+    for ( int i = 0; i < sampleCount && bufferPos + ROW_BUFFER_SIZE <= size; i++ )
+    {
+        bufferPos += formatSample( &latest[i], buffer + bufferPos, ROW_BUFFER_SIZE );
+    }
+    return bufferPos;
+}
+
+// Function to render the last 10 entries into buffer
+// Returns the number of bytes written, or -1 on error
+int formatLast10Entries( char *buffer, size_t size )
+{
+    // Served from memory once the sample feed has loaded the ring
+    int length = ringFormatLatest( buffer, size );
+    if ( length >= 0 )
+    {
+        return length;
+    }
+
+    sqlite3_stmt *stmt = stmtAcquire( QUERY_LAST_10 );
+    if ( stmt == NULL )
+    {
+        return -1;
+    }
+
+    // Initialize buffer position
+    size_t bufferPos = 0;
+    buffer[0] = '\0';
+
+    // Append each row to the buffer
+    while ( stepTimed( stmt ) == SQLITE_ROW && bufferPos < size )
+    {
+        // Format the data and append it to the buffer
+        bufferPos += formatRow( stmt, buffer + bufferPos, size - bufferPos );
+    }
+
+    stmtRelease( QUERY_LAST_10, stmt );
+
+    return strlen( buffer );
+}
+
+// Make room for len more bytes of output on a connection
+int connReserve ( struct Connection *conn, size_t len )
+{
+    if ( conn->outLen + len > conn->outCapacity )
+    {
+        size_t capacity = conn->outCapacity ? conn->outCapacity : RECV_BUFFER_SIZE;
+        while ( capacity < conn->outLen + len )
+        {
+            capacity *= 2;
+        }
+
+        char *outBuffer = realloc( conn->outBuffer, capacity );
+        if ( outBuffer == NULL )
+        {
+            syslog( LOG_ERR, "Failed to allocate memory" );
+            return -1;
+        }
+        conn->outBuffer = outBuffer;
+        conn->outCapacity = capacity;
+    }
+    return 0;
+}
+
+// Queue data on a connection, growing the output buffer as needed
+int connQueue ( struct Connection *conn, const char *data, size_t len )
+{
+    if ( connReserve( conn, len ) == -1 )
+    {
+        return -1;
+    }
+
+    memcpy( conn->outBuffer + conn->outLen, data, len );
+    conn->outLen += len;
+    return 0;
+}
+
+// Send as much queued output as the socket accepts without blocking
+// Returns 0 when the socket is drained or would block, -1 on error
+int connFlush ( struct Connection *conn )
+{
+    while ( conn->outSent < conn->outLen )
+    {
+        ssize_t sent = send( conn->clientSocket, conn->outBuffer + conn->outSent,
+                             conn->outLen - conn->outSent, MSG_NOSIGNAL );
+        if ( sent == -1 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                return 0;
+            }
+            syslog( LOG_ERR, "Failed to send data: %s", strerror( errno ) );
+            return -1;
+        }
+        conn->outSent += sent;
+        metricAdd( &threadMetrics()->bytesOut, sent );
+    }
+
+    // Everything went out, reuse the buffer from the start
+    conn->outLen = 0;
+    conn->outSent = 0;
+    return 0;
+}
+
+// Hand a finished cursor back to the statement cache
+void connEndCursor ( struct Connection *conn )
+{
+    stmtRelease( conn->cursorQuery, conn->cursor );
+    conn->cursor = NULL;
+}
+
+// Step the connection's cursor; returns SQLITE_ROW, or ends the cursor and
+// returns 0 when it is done and -1 on error
+int connStep ( struct Connection *conn )
+{
+    int result = stepTimed( conn->cursor );
+    if ( result == SQLITE_ROW )
+    {
+        return SQLITE_ROW;
+    }
+    if ( result != SQLITE_DONE )
+    {
+        syslog( LOG_ERR, "SQL error: %s", sqlite3_errmsg( sqlite3_db_handle( conn->cursor ) ) );
+    }
+    connEndCursor( conn );
+    return result == SQLITE_DONE ? 0 : -1;
+}
+
+// Bind a query to the connection's cursor
+int connOpenCursor ( struct Connection *conn, enum QueryId id )
+{
+    conn->cursor = stmtAcquire( id );
+    if ( conn->cursor == NULL )
+    {
+        return -1;
+    }
+    conn->cursorQuery = id;
+    return 0;
+}
+
+// Producer that renders the cursor's rows straight into the output buffer
+// Produces at most STREAM_CHUNK_SIZE bytes per call so memory stays flat
+int produceRows ( struct Connection *conn )
+{
+    if ( connReserve( conn, STREAM_CHUNK_SIZE ) == -1 )
+    {
+        return -1;
+    }
+
+    while ( conn->outLen + ROW_BUFFER_SIZE <= STREAM_CHUNK_SIZE )
+    {
+        int result = connStep( conn );
+        if ( result != SQLITE_ROW )
+        {
+            conn->produce = NULL;
+            return result;
+        }
+
+        int length = formatRow( conn->cursor, conn->outBuffer + conn->outLen, ROW_BUFFER_SIZE );
+        conn->outLen += length < ROW_BUFFER_SIZE ? length : ROW_BUFFER_SIZE - 1;
+    }
+    return 0;
+}
+
+// Start streaming "range <from_ts> <to_ts> [limit]" to the client
+int connStartRange ( struct Connection *conn, const char *command )
+{
+    long long fromTs, toTs, limit = -1;
+
+    if ( sscanf( command, "range %lld %lld %lld", &fromTs, &toTs, &limit ) < 2 )
+    {
+        const char *usage = "ERROR: usage: range <from_ts> <to_ts> [limit]\n";
+        return connQueue( conn, usage, strlen( usage ) );
+    }
+
+    if ( connOpenCursor( conn, QUERY_RANGE ) == -1 )
+    {
+        return -1;
+    }
+
+    // A negative LIMIT means no limit to SQLite
+    sqlite3_bind_int64( conn->cursor, 1, fromTs );
+    sqlite3_bind_int64( conn->cursor, 2, toTs );
+    sqlite3_bind_int64( conn->cursor, 3, limit );
+    conn->produce = produceRows;
+    return 0;
+}
+
+// Free the downsampling state of a connection
+void lttbFree ( struct Connection *conn )
+{
+    if ( conn->lttb != NULL )
+    {
+        free( conn->lttb->avgTime );
+        free( conn->lttb );
+        conn->lttb = NULL;
+    }
+}
+
+// Series value of a sample selected by column number
+double lttbValue ( const struct Lttb *lttb, const struct Sample *sample )
+{
+    return lttb->series == 1 ? sample->temperature :
+           lttb->series == 2 ? sample->humidity : sample->pressure;
+}
+
+// Second pass: stream raw rows and keep, per bucket, the point forming the
+// largest triangle with the previously kept point and the next bucket's average
+int lttbSelect ( struct Connection *conn )
+{
+    struct Lttb *lttb = conn->lttb;
+
+    if ( connReserve( conn, STREAM_CHUNK_SIZE ) == -1 )
+    {
+        return -1;
+    }
+
+    while ( conn->outLen + ROW_BUFFER_SIZE <= STREAM_CHUNK_SIZE )
+    {
+        int result = connStep( conn );
+        if ( result != SQLITE_ROW )
+        {
+            // The last bucket always ends on the last point
+            if ( result == 0 && lttb->currentBucket != -1 )
+            {
+                conn->outLen += formatSample( &lttb->best, conn->outBuffer + conn->outLen, ROW_BUFFER_SIZE );
+            }
+            lttbFree( conn );
+            conn->produce = NULL;
+            return result;
+        }
+
+        struct Sample sample;
+        readSample( conn->cursor, &sample );
+        int bucket = ( ( sample.timestamp - lttb->fromTs ) * lttb->points ) / ( lttb->toTs - lttb->fromTs + 1 );
+
+        if ( bucket != lttb->currentBucket )
+        {
+            // Emit the winner of the bucket that just ended
+            if ( lttb->currentBucket != -1 )
+            {
+                conn->outLen += formatSample( &lttb->best, conn->outBuffer + conn->outLen, ROW_BUFFER_SIZE );
+                lttb->selected = lttb->best;
+            }
+            lttb->currentBucket = bucket;
+            lttb->bestArea = -1;
+        }
+
+        if ( bucket == lttb->firstBucket )
+        {
+            // The first bucket always starts on the first point
+            if ( lttb->bestArea < 0 )
+            {
+                lttb->best = sample;
+                lttb->bestArea = 0;
+            }
+        }
+        else if ( bucket == lttb->lastBucket || lttb->nextBucket[bucket] == -1 )
+        {
+            lttb->best = sample;
+        }
+        else
+        {
+            int next = lttb->nextBucket[bucket];
+            double ax = lttb->selected.timestamp, ay = lttbValue( lttb, &lttb->selected );
+            double bx = sample.timestamp, by = lttbValue( lttb, &sample );
+            double cx = lttb->avgTime[next], cy = lttb->avgValue[next];
+            double area = ( ax - cx ) * ( by - ay ) - ( ax - bx ) * ( cy - ay );
+            if ( area < 0 )
+            {
+                area = -area;
+            }
+            if ( area > lttb->bestArea )
+            {
+                lttb->best = sample;
+                lttb->bestArea = area;
+            }
+        }
+    }
+    return 0;
+}
+
+// First pass: collect the average point of every non-empty bucket
+int lttbBuckets ( struct Connection *conn )
+{
+    struct Lttb *lttb = conn->lttb;
+    int result;
+
+    while ( ( result = connStep( conn ) ) == SQLITE_ROW )
+    {
+        int bucket = sqlite3_column_int( conn->cursor, 4 );
+        if ( bucket < 0 || bucket >= lttb->points )
+        {
+            continue;
+        }
+        lttb->avgTime[bucket] = sqlite3_column_double( conn->cursor, 0 );
+        lttb->avgValue[bucket] = sqlite3_column_double( conn->cursor, lttb->series );
+        lttb->nextBucket[bucket] = 0;
+        if ( lttb->firstBucket == -1 )
+        {
+            lttb->firstBucket = bucket;
+        }
+        lttb->lastBucket = bucket;
+    }
+    if ( result == -1 || lttb->firstBucket == -1 )
+    {
+        // Error, or nothing in range
+        lttbFree( conn );
+        conn->produce = NULL;
+        return result;
+    }
+
+    // Link every bucket to the next non-empty one
+    int next = -1;
+    for ( int i = lttb->points - 1; i >= 0; i-- )
+    {
+        bool isEmpty = lttb->nextBucket[i] == -1;
+        lttb->nextBucket[i] = next;
+        if ( !isEmpty )
+        {
+            next = i;
+        }
+    }
+
+    if ( connOpenCursor( conn, QUERY_RANGE ) == -1 )
+    {
+        return -1;
+    }
+    sqlite3_bind_int64( conn->cursor, 1, lttb->fromTs );
+    sqlite3_bind_int64( conn->cursor, 2, lttb->toTs );
+    sqlite3_bind_int64( conn->cursor, 3, -1 );
+    conn->produce = lttbSelect;
+    return 0;
+}
+
+// Start "agg <from_ts> <to_ts> <points> [avg|min|max|lttb] [temperature|humidity|pressure]"
+// Returns at most <points> rows whatever the number of samples in the range.
+// avg averages every column of a bucket and ignores the series. min and max return
+// the stored sample holding the series' extreme, lttb the sample LTTB selects for it.
+int connStartAggregate ( struct Connection *conn, const char *command )
+{
+    long long fromTs, toTs;
+    int points;
+    char mode[16] = "avg";
+    char series[16] = "temperature";
+
+    int fields = sscanf( command, "agg %lld %lld %d %15s %15s", &fromTs, &toTs, &points, mode, series );
+    if ( fields < 3 || toTs < fromTs || points < 1 || points > MAX_DOWNSAMPLE_POINTS )
+    {
+        const char *usage = "ERROR: usage: agg <from_ts> <to_ts> <points> [avg|min|max|lttb] "
+                            "[temperature|humidity|pressure]\n";
+        return connQueue( conn, usage, strlen( usage ) );
+    }
+
+    int column = strcmp( series, "temperature" ) == 0 ? 1 :
+                 strcmp( series, "humidity" ) == 0 ? 2 :
+                 strcmp( series, "pressure" ) == 0 ? 3 : 0;
+    if ( column == 0 )
+    {
+        const char *error = "ERROR: unknown series\n";
+        return connQueue( conn, error, strlen( error ) );
+    }
+
+    enum QueryId id;
+    if ( strcmp( mode, "avg" ) == 0 || strcmp( mode, "lttb" ) == 0 )
+    {
+        id = QUERY_BUCKET_AVG;
+    }
+    else if ( strcmp( mode, "min" ) == 0 )
+    {
+        id = QUERY_BUCKET_MIN;
+    }
+    else if ( strcmp( mode, "max" ) == 0 )
+    {
+        id = QUERY_BUCKET_MAX;
+    }
+    else
+    {
+        const char *error = "ERROR: unknown aggregation mode\n";
+        return connQueue( conn, error, strlen( error ) );
+    }
+
+    conn->produce = produceRows;
+    if ( strcmp( mode, "lttb" ) == 0 )
+    {
+        struct Lttb *lttb = calloc( 1, sizeof( struct Lttb ) );
+        void *arrays = malloc( points * ( 2 * sizeof( double ) + sizeof( int ) ) );
+        if ( lttb == NULL || arrays == NULL )
+        {
+            syslog( LOG_ERR, "Failed to allocate memory" );
+            free( lttb );
+            free( arrays );
+            return -1;
+        }
+        lttb->fromTs = fromTs;
+        lttb->toTs = toTs;
+        lttb->points = points;
+        lttb->series = column;
+        lttb->avgTime = arrays;
+        lttb->avgValue = lttb->avgTime + points;
+        lttb->nextBucket = ( int * ) ( lttb->avgValue + points );
+        for ( int i = 0; i < points; i++ )
+        {
+            lttb->nextBucket[i] = -1;
+        }
+        lttb->firstBucket = -1;
+        lttb->lastBucket = -1;
+        lttb->currentBucket = -1;
+        conn->lttb = lttb;
+        conn->produce = lttbBuckets;
+    }
+
+    if ( connOpenCursor( conn, id ) == -1 )
+    {
+        lttbFree( conn );
+        conn->produce = NULL;
+        return -1;
+    }
+    sqlite3_bind_int64( conn->cursor, 1, fromTs );
+    sqlite3_bind_int64( conn->cursor, 2, toTs );
+    sqlite3_bind_int( conn->cursor, 3, points );
+    if ( id != QUERY_BUCKET_AVG )
+    {
+        sqlite3_bind_int( conn->cursor, 4, column );
+    }
+    return 0;
+}
+
+// Report the query plan of every cached query, one line per plan step
+// Steps that walk the whole table without an index are flagged
+int connExplain ( struct Connection *conn )
+{
+    char sql[512];
+    char line[ROW_BUFFER_SIZE];
+    struct StatementCache *cache = stmtCache();
+
+    if ( cache == NULL )
+    {
+        return -1;
+    }
+
+    // EXPLAIN does not check the schema cookie; reading sqlite_master does,
+    // so indexes created since the schema was last loaded are seen
+    sqlite3_exec( cache->db, "SELECT 1 FROM sqlite_master LIMIT 1;", NULL, NULL, NULL );
+
+    for ( int i = 0; i < QUERY_COUNT; i++ )
+    {
+        sqlite3_stmt *stmt;
+        snprintf( sql, sizeof( sql ), "EXPLAIN QUERY PLAN %s", querySql[i] );
+        if ( sqlite3_prepare_v2( cache->db, sql, -1, &stmt, NULL ) != SQLITE_OK )
+        {
+            snprintf( line, sizeof( line ), "%s: ERROR: %s\n", queryName[i], sqlite3_errmsg( cache->db ) );
+            if ( connQueue( conn, line, strlen( line ) ) == -1 )
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        while ( stepTimed( stmt ) == SQLITE_ROW )
+        {
+            const char *detail = ( const char * ) sqlite3_column_text( stmt, 3 );
+            bool isFullScan = strncmp( detail, "SCAN ", 5 ) == 0 && strstr( detail, "INDEX" ) == NULL;
+            int length = snprintf( line, sizeof( line ), "%s: %s%s\n", queryName[i], detail,
+                                   isFullScan ? " [FULL SCAN]" : "" );
+            if ( connQueue( conn, line, length < ( int ) sizeof( line ) ? length : ( int ) sizeof( line ) - 1 ) == -1 )
+            {
+                sqlite3_finalize( stmt );
+                return -1;
+            }
+        }
+        sqlite3_finalize( stmt );
+    }
+    return 0;
+}
+
+// Append formatted text to the output of a connection
+int connPrintf ( struct Connection *conn, const char *format, ... )
+{
+    va_list args;
+
+    va_start( args, format );
+    int length = vsnprintf( NULL, 0, format, args );
+    va_end( args );
+    if ( length < 0 || connReserve( conn, length + 1 ) == -1 )
+    {
+        return -1;
+    }
+
+    va_start( args, format );
+    vsnprintf( conn->outBuffer + conn->outLen, length + 1, format, args );
+    va_end( args );
+    conn->outLen += length;
+    return 0;
+}
+
+// Render a histogram in the text exposition format, with cumulative buckets
+// label is either empty or a single name="value" pair
+int connPrintHistogram ( struct Connection *conn, const char *name, const char *label,
+                         const struct LatencyHistogram *histogram )
+{
+    const char *separator = label[0] != '\0' ? "," : "";
+    uint64_t cumulative = 0;
+
+    for ( int i = 0; i < METRIC_BUCKETS - 1; i++ )
+    {
+        cumulative += histogram->buckets[i];
+        if ( connPrintf( conn, "%s_bucket{%s%sle=\"%.6f\"} %llu\n", name, label, separator,
+                         ( double ) ( 1ULL << i ) / 1e6, ( unsigned long long ) cumulative ) == -1 )
+        {
+            return -1;
+        }
+    }
+    return connPrintf( conn, "%s_bucket{%s%sle=\"+Inf\"} %llu\n"
+                             "%s_sum%s%s%s %.9f\n"
+                             "%s_count%s%s%s %llu\n",
+                       name, label, separator, ( unsigned long long ) histogram->count,
+                       name, label[0] != '\0' ? "{" : "", label, label[0] != '\0' ? "}" : "",
+                       histogram->sumNs / 1e9,
+                       name, label[0] != '\0' ? "{" : "", label, label[0] != '\0' ? "}" : "",
+                       ( unsigned long long ) histogram->count );
+}
+
+// Report the server's counters and histograms in the Prometheus text format
+int connStats ( struct Connection *conn )
+{
+    struct ThreadMetrics *total = malloc( sizeof( struct ThreadMetrics ) );
+    int threadCount[ROLE_COUNT] = { 0 };
+    struct ThreadMetrics *metrics;
+    char label[64];
+
+    if ( total == NULL )
+    {
+        syslog( LOG_ERR, "Failed to allocate memory" );
+        return -1;
+    }
+
+    // Sum every thread's counters; they keep running while this reads them
+    uint64_t now = metricsNow();
+    pthread_mutex_lock( &metricsRegistry.lock );
+    *total = metricsRegistry.retired;
+    LIST_FOREACH( metrics, &metricsRegistry.threads, entries )
+    {
+        metricsAdd( total, metrics );
+        threadCount[metrics->role]++;
+    }
+    pthread_mutex_unlock( &metricsRegistry.lock );
+
+    lockMutex( &sampleFeed.lock, LOCK_SAMPLE_FEED );
+    int subscriberCount = sampleFeed.subscriberCount;
+    pthread_mutex_unlock( &sampleFeed.lock );
+
+    int result = connPrintf( conn,
+        "# HELP aesdsocket_uptime_seconds Time since the server started\n"
+        "# TYPE aesdsocket_uptime_seconds gauge\n"
+        "aesdsocket_uptime_seconds %.3f\n"
+        "# HELP aesdsocket_connections_active Client connections currently open, subscribers included\n"
+        "# TYPE aesdsocket_connections_active gauge\n"
+        "aesdsocket_connections_active %llu\n"
+        "# HELP aesdsocket_subscribers Connections receiving pushed samples\n"
+        "# TYPE aesdsocket_subscribers gauge\n"
+        "aesdsocket_subscribers %d\n"
+        "# HELP aesdsocket_accepts_total Connections accepted, rate() gives the accept rate\n"
+        "# TYPE aesdsocket_accepts_total counter\n"
+        "aesdsocket_accepts_total %llu\n"
+        "# HELP aesdsocket_received_bytes_total Bytes received from clients\n"
+        "# TYPE aesdsocket_received_bytes_total counter\n"
+        "aesdsocket_received_bytes_total %llu\n"
+        "# HELP aesdsocket_sent_bytes_total Bytes sent to clients, pushed samples included\n"
+        "# TYPE aesdsocket_sent_bytes_total counter\n"
+        "aesdsocket_sent_bytes_total %llu\n"
+        "# HELP aesdsocket_threads Threads currently running, by role\n"
+        "# TYPE aesdsocket_threads gauge\n",
+        ( now - metricsRegistry.startedNs ) / 1e9, ( unsigned long long ) ( total->opened - total->closed ),
+        subscriberCount, ( unsigned long long ) total->accepts,
+        ( unsigned long long ) total->bytesIn, ( unsigned long long ) total->bytesOut );
+    for ( int i = 0; i < ROLE_COUNT && result == 0; i++ )
+    {
+        result = connPrintf( conn, "aesdsocket_threads{role=\"%s\"} %d\n", roleName[i], threadCount[i] );
+    }
+
+    if ( result == 0 )
+    {
+        result = connPrintf( conn, "# HELP aesdsocket_command_duration_seconds Time from receiving a command "
+                                   "to producing the last of its response\n"
+                                   "# TYPE aesdsocket_command_duration_seconds histogram\n" );
+    }
+    for ( int i = 0; i < COMMAND_COUNT && result == 0; i++ )
+    {
+        snprintf( label, sizeof( label ), "command=\"%s\"", commandName[i] );
+        result = connPrintHistogram( conn, "aesdsocket_command_duration_seconds", label, &total->commands[i] );
+    }
+
+    if ( result == 0 )
+    {
+        result = connPrintf( conn, "# HELP aesdsocket_sqlite_step_seconds Time spent in each sqlite3_step call\n"
+                                   "# TYPE aesdsocket_sqlite_step_seconds histogram\n" );
+    }
+    if ( result == 0 )
+    {
+        result = connPrintHistogram( conn, "aesdsocket_sqlite_step_seconds", "", &total->sqliteStep );
+    }
+
+    if ( result == 0 )
+    {
+        result = connPrintf( conn, "# HELP aesdsocket_lock_wait_seconds Time spent waiting to acquire a lock\n"
+                                   "# TYPE aesdsocket_lock_wait_seconds histogram\n" );
+    }
+    for ( int i = 0; i < LOCK_COUNT && result == 0; i++ )
+    {
+        snprintf( label, sizeof( label ), "lock=\"%s\"", lockName[i] );
+        result = connPrintHistogram( conn, "aesdsocket_lock_wait_seconds", label, &total->lockWait[i] );
+    }
+
+    free( total );
+    return result;
+}
+
+// Handle one chunk received on a connection
+int connHandleCommand ( struct Connection *conn, const char *buffer, size_t len )
+{
+    if ( ( len > 6 && strncmp( buffer, "range ", 6 ) == 0 ) || ( len > 4 && strncmp( buffer, "agg ", 4 ) == 0 ) )
+    {
+        // Parameterized commands are parsed from a terminated copy
+        char command[RECV_BUFFER_SIZE + 1];
+        memcpy( command, buffer, len );
+        command[len] = '\0';
+
+        if ( command[0] == 'r' )
+        {
+            conn->command = COMMAND_RANGE;
+            return connStartRange( conn, command );
+        }
+        conn->command = COMMAND_AGG;
+        return connStartAggregate( conn, command );
+    }
+
+    if ( len >= 4 && strncmp( buffer, "plan", 4 ) == 0 )
+    {
+        conn->command = COMMAND_PLAN;
+        return connExplain( conn );
+    }
+
+    if ( len >= 5 && strncmp( buffer, "stats", 5 ) == 0 )
+    {
+        conn->command = COMMAND_STATS;
+        return connStats( conn );
+    }
+
+    // From now on the connection only receives pushed samples
+    if ( len >= 9 && strncmp( buffer, "subscribe", 9 ) == 0 )
+    {
+        conn->command = COMMAND_SUBSCRIBE;
+        conn->state = CONN_SUBSCRIBED;
+        return 0;
+    }
+
+    // Check if the received command is "get10"
+    if ( len >= 5 && strncmp( buffer, "get10", 5 ) == 0 )
+    {
+        conn->command = COMMAND_GET10;
+        char response[GET10_BUFFER_SIZE];
+        int length = formatLast10Entries( response, sizeof( response ) );
+        if ( length < 0 )
+        {
+            return -1;
+        }
+
+        lockWrite( &dataFileLock, LOCK_DATA_FILE );
+        ssize_t written = write( conn->dataFd, response, length );
+        pthread_rwlock_unlock( &dataFileLock );
+        if ( written == -1 )
+        {
+            syslog( LOG_ERR, "Failed to write to file %s: %s", DATA_FILE, strerror( errno ) );
+            return -1;
+        }
+
+        return connQueue( conn, response, length );
+    }
+
+    // Echo back the received data to the client
+    conn->command = COMMAND_ECHO;
+    return connQueue( conn, buffer, len );
+}
+
+// Drop a subscriber; called with the feed lock held
+void feedRemove ( struct Subscriber *subscriber )
+{
+    syslog( LOG_INFO, "Closed connection from %s", subscriber->ipAddress );
+    LIST_REMOVE( subscriber, entries );
+    sampleFeed.subscriberCount--;
+    epoll_ctl( sampleFeed.epollFd, EPOLL_CTL_DEL, subscriber->clientSocket, NULL );
+    close( subscriber->clientSocket );
+    metricAdd( &threadMetrics()->closed, 1 );
+    free( subscriber );
+}
+
+// Take over the socket of a connection that sent "subscribe"
+void feedSubscribe ( struct Connection *conn )
+{
+    struct Subscriber *subscriber = malloc( sizeof( struct Subscriber ) );
+    if ( subscriber == NULL )
+    {
+        syslog( LOG_ERR, "Failed to allocate memory" );
+        return;
+    }
+    subscriber->clientSocket = conn->clientSocket;
+    memcpy( subscriber->ipAddress, conn->ipAddress, sizeof( subscriber->ipAddress ) );
+
+    // Only hangups and stray input are watched, output is pushed by the feed
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = subscriber;
+
+    lockMutex( &sampleFeed.lock, LOCK_SAMPLE_FEED );
+    if ( epoll_ctl( sampleFeed.epollFd, EPOLL_CTL_ADD, subscriber->clientSocket, &event ) == -1 )
+    {
+        pthread_mutex_unlock( &sampleFeed.lock );
+        syslog( LOG_ERR, "Failed to register subscriber: %s", strerror( errno ) );
+        free( subscriber );
+        return;
+    }
+    LIST_INSERT_HEAD( &sampleFeed.subscribers, subscriber, entries );
+    sampleFeed.subscriberCount++;
+    pthread_mutex_unlock( &sampleFeed.lock );
+
+    syslog( LOG_INFO, "Subscribed connection from %s", conn->ipAddress );
+    conn->clientSocket = -1;
+}
+
+// Send one block of samples to every subscriber
+// A subscriber that cannot take it without blocking is too slow and is dropped
+void feedBroadcast ( const char *buffer, size_t len )
+{
+    struct Subscriber *subscriber, *nextSubscriber;
+
+    lockMutex( &sampleFeed.lock, LOCK_SAMPLE_FEED );
+    LIST_FOREACH_SAFE( subscriber, &sampleFeed.subscribers, entries, nextSubscriber )
+    {
+        ssize_t sent = send( subscriber->clientSocket, buffer, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( sent > 0 )
+        {
+            metricAdd( &threadMetrics()->bytesOut, sent );
+        }
+        if ( sent != ( ssize_t ) len )
+        {
+            syslog( LOG_WARNING, "Dropping subscriber %s: %s", subscriber->ipAddress,
+                    sent == -1 ? strerror( errno ) : "send buffer full" );
+            feedRemove( subscriber );
+        }
+    }
+    pthread_mutex_unlock( &sampleFeed.lock );
+}
+
+// Prepare the feed's statements once sensor_data exists
+int feedPrepare ( void )
+{
+    if ( sampleFeed.newRowsStmt != NULL )
+    {
+        return 0;
+    }
+
+    if ( sqlite3_prepare_v3( sampleFeed.db, "PRAGMA data_version;", -1, SQLITE_PREPARE_PERSISTENT,
+                             &sampleFeed.versionStmt, NULL ) != SQLITE_OK ||
+         sqlite3_prepare_v3( sampleFeed.db, "SELECT timestamp, temperature, humidity, pressure, rowid "
+                             "FROM sensor_data WHERE rowid > ?1 ORDER BY rowid;", -1,
+                             SQLITE_PREPARE_PERSISTENT, &sampleFeed.newRowsStmt, NULL ) != SQLITE_OK )
+    {
+        sqlite3_finalize( sampleFeed.versionStmt );
+        sampleFeed.versionStmt = NULL;
+        sampleFeed.newRowsStmt = NULL;
+        return -1;
+    }
+
+    // Only rows stored after this point are pushed, whether or not the ring warms up
+    sqlite3_stmt *stmt;
+    int result = SQLITE_ERROR;
+    if ( sqlite3_prepare_v2( sampleFeed.db, "SELECT max( rowid ) FROM sensor_data;", -1, &stmt, NULL ) == SQLITE_OK )
+    {
+        result = stepTimed( stmt );
+        if ( result == SQLITE_ROW )
+        {
+            sampleFeed.lastRowid = sqlite3_column_int64( stmt, 0 );
+        }
+    }
+    sqlite3_finalize( stmt );
+    if ( result != SQLITE_ROW )
+    {
+        syslog( LOG_ERR, "Failed to find the newest sample: %s", sqlite3_errmsg( sampleFeed.db ) );
+        sqlite3_finalize( sampleFeed.versionStmt );
+        sqlite3_finalize( sampleFeed.newRowsStmt );
+        sampleFeed.versionStmt = NULL;
+        sampleFeed.newRowsStmt = NULL;
+        return -1;
+    }
+
+    // Warm the ring with the latest of those rows; if that fails, get10 keeps querying SQLite
+    struct Sample warm[SAMPLE_RING_CAPACITY];
+    int warmCount = 0;
+    result = SQLITE_ERROR;
+    if ( sqlite3_prepare_v2( sampleFeed.db, "SELECT timestamp, temperature, humidity, pressure, rowid "
+                             "FROM sensor_data WHERE rowid <= ?1 ORDER BY timestamp DESC, rowid DESC LIMIT ?2;", -1,
+                             &stmt, NULL ) == SQLITE_OK )
+    {
+        sqlite3_bind_int64( stmt, 1, sampleFeed.lastRowid );
+        sqlite3_bind_int( stmt, 2, SAMPLE_RING_CAPACITY );
+        while ( ( result = stepTimed( stmt ) ) == SQLITE_ROW )
+        {
+            readSample( stmt, &warm[warmCount++] );
+        }
+    }
+    sqlite3_finalize( stmt );
+    if ( result != SQLITE_DONE )
+    {
+        syslog( LOG_ERR, "Failed to warm the sample ring: %s", sqlite3_errmsg( sampleFeed.db ) );
+        return 0;
+    }
+
+    // Oldest first, so every push is an append
+    while ( warmCount > 0 )
+    {
+        ringPush( &warm[--warmCount] );
+    }
+
+    lockWrite( &sampleRing.lock, LOCK_SAMPLE_RING );
+    sampleRing.isWarm = true;
+    pthread_rwlock_unlock( &sampleRing.lock );
+    return 0;
+}
+
+// Deliver every row stored since the last check
+void feedPoll ( void )
+{
+    static sqlite3_int64 lastVersion = -1;
+    char buffer[STREAM_CHUNK_SIZE];
+    size_t bufferPos = 0;
+
+    if ( feedPrepare() == -1 )
+    {
+        return;
+    }
+
+    // data_version changes whenever another connection commits to the database
+    sqlite3_int64 version = -1;
+    if ( stepTimed( sampleFeed.versionStmt ) == SQLITE_ROW )
+    {
+        version = sqlite3_column_int64( sampleFeed.versionStmt, 0 );
+    }
+    sqlite3_reset( sampleFeed.versionStmt );
+    if ( version == lastVersion )
+    {
+        return;
+    }
+    lastVersion = version;
+
+    sqlite3_bind_int64( sampleFeed.newRowsStmt, 1, sampleFeed.lastRowid );
+    while ( stepTimed( sampleFeed.newRowsStmt ) == SQLITE_ROW )
+    {
+        struct Sample sample;
+        readSample( sampleFeed.newRowsStmt, &sample );
+        ringPush( &sample );
+
+        sampleFeed.lastRowid = sqlite3_column_int64( sampleFeed.newRowsStmt, 4 );
+        bufferPos += formatSample( &sample, buffer + bufferPos, ROW_BUFFER_SIZE );
+        if ( bufferPos + ROW_BUFFER_SIZE > sizeof( buffer ) )
+        {
+            feedBroadcast( buffer, bufferPos );
+            bufferPos = 0;
+        }
+    }
+    sqlite3_reset( sampleFeed.newRowsStmt );
+
+    if ( bufferPos > 0 )
+    {
+        feedBroadcast( buffer, bufferPos );
+    }
+}
+
+// Sample feed thread: watch subscribers for hangups, poll for new rows
+void *feedLoop ( void *arg )
+{
+    struct epoll_event events[FEED_MAX_EVENTS];
+    char discard[RECV_BUFFER_SIZE];
+
+    metricsThreadStart( ROLE_FEED );
+    while ( 1 )
+    {
+        int eventCount = epoll_wait( sampleFeed.epollFd, events, FEED_MAX_EVENTS, FEED_POLL_INTERVAL_MS );
+        for ( int i = 0; i < eventCount; i++ )
+        {
+            struct Subscriber *subscriber = events[i].data.ptr;
+
+            // Subscribers have nothing more to say; input is dropped, EOF ends the subscription
+            ssize_t bytesReceived = recv( subscriber->clientSocket, discard, sizeof( discard ), MSG_DONTWAIT );
+            if ( bytesReceived == 0 || ( bytesReceived == -1 && errno != EAGAIN && errno != EINTR ) )
+            {
+                lockMutex( &sampleFeed.lock, LOCK_SAMPLE_FEED );
+                feedRemove( subscriber );
+                pthread_mutex_unlock( &sampleFeed.lock );
+            }
+        }
+
+        feedPoll();
+    }
+    return NULL;
+}
+
+// Open the feed's own database connection and start its thread
+int feedStart ( void )
+{
+    pthread_mutex_init( &sampleFeed.lock, NULL );
+    LIST_INIT( &sampleFeed.subscribers );
+
+    sampleFeed.epollFd = epoll_create1( EPOLL_CLOEXEC );
+    if ( sampleFeed.epollFd == -1 )
+    {
+        syslog( LOG_ERR, "Failed to create epoll instance: %s", strerror( errno ) );
+        return -1;
+    }
+
+    if ( sqlite3_open_v2( DATABASE_FILE, &sampleFeed.db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                          NULL ) != SQLITE_OK )
+    {
+        syslog( LOG_ERR, "Can't open database: %s", sqlite3_errmsg( sampleFeed.db ) );
+        return -1;
+    }
+    sqlite3_busy_timeout( sampleFeed.db, DB_BUSY_TIMEOUT_MS );
+    feedPrepare();
+
+    if ( startThread( &sampleFeed.thread, feedLoop, NULL ) != 0 )
+    {
+        syslog( LOG_ERR, "Failed to create sample feed thread" );
+        return -1;
+    }
+    return 0;
+}
+
+// Set up the context of a freshly accepted connection
+// On failure nothing but the client socket is left open
+int connInit ( struct Connection *conn, int clientSocket )
+{
+    struct sockaddr_in clientAddr;
+    socklen_t addrSize = sizeof( clientAddr );
+
+    memset( conn, 0, sizeof( *conn ) );
+    conn->clientSocket = clientSocket;
+    conn->dataFd = -1;
+    conn->state = CONN_READING;
+
+    // Get client address information
+    if ( getpeername( clientSocket, ( struct sockaddr * )&clientAddr, &addrSize ) == -1 )
+    {
+        // Log an error if getting client address fails
+        syslog( LOG_ERR, "Failed to get client address: %s", strerror( errno ) );
+        return -1;
+    }
+
+    // Convert the client IP address to a string format
+    inet_ntop( AF_INET, &clientAddr.sin_addr, conn->ipAddress, sizeof( conn->ipAddress ) );
 
-// Structure to hold thread information
-struct ThreadInfo
+    // Each connection appends through its own descriptor
+    conn->dataFd = open( DATA_FILE, O_CREAT | O_RDWR | O_APPEND, 0744 );
+    if ( conn->dataFd == -1 )
+    {
+        syslog( LOG_ERR, "Failed to open file %s: %s", DATA_FILE, strerror( errno ) );
+        return -1;
+    }
+
+    // Log a message indicating the accepted connection
+    syslog( LOG_INFO, "Accepted connection from %s", conn->ipAddress );
+    metricAdd( &threadMetrics()->opened, 1 );
+    return 0;
+}
+
+// Release everything held by a connection context
+// The socket is left alone if it was handed to the sample feed
+void connRelease ( struct Connection *conn )
 {
-    pthread_t threadId;
-    int clientSocket;
-    bool threadComplete;
-    SLIST_ENTRY( ThreadInfo ) entries;
-};
+    if ( conn->clientSocket != -1 )
+    {
+        syslog( LOG_INFO, "Closed connection from %s", conn->ipAddress );
+        close( conn->clientSocket );
+        metricAdd( &threadMetrics()->closed, 1 );
+    }
+    if ( conn->cursor != NULL )
+    {
+        connEndCursor( conn );
+    }
+    lttbFree( conn );
+    if ( conn->dataFd != -1 )
+    {
+        close( conn->dataFd );
+    }
+    free( conn->outBuffer );
+}
 
-// Declare the head of the singly linked list
-SLIST_HEAD( ThreadHead, ThreadInfo ) threadHead;
+// Record the latency of the command a connection has finished serving
+void connCommandDone ( struct Connection *conn )
+{
+    histogramRecord( &threadMetrics()->commands[conn->command], metricsNow() - conn->commandStart );
+}
 
-// Signal handler function to catch SIGINT and SIGTERM signals
-void signalHandler ( int sig )
+// Advance the connection state machine as far as the socket allows
+// On a blocking socket this runs until the connection is finished
+// Returns 0 to keep the connection, 1 when it is finished, -1 on error,
+// 2 when the client subscribed and the socket must go to the sample feed
+int connService ( struct Connection *conn )
 {
-    // Check if the signal is SIGINT or SIGTERM
-    if ( sig == SIGINT || sig == SIGTERM )
+    char buffer[RECV_BUFFER_SIZE];
+
+    while ( 1 )
     {
-        // Log a message indicating the signal caught
-        syslog( LOG_INFO, "Caught signal, exiting" );
+        // Never read more input while earlier output is still pending
+        if ( connFlush( conn ) == -1 )
+        {
+            return -1;
+        }
+        if ( conn->outLen != 0 )
+        {
+            return 0;
+        }
 
-        // Attempt to close the socket file descriptor
-        if ( serverSocket != -1 )
+        // Finish streaming the current response before reading the next command
+        if ( conn->produce != NULL )
         {
-            shutdown( serverSocket, SHUT_RDWR );
+            if ( conn->produce( conn ) == -1 )
+            {
+                return -1;
+            }
+            if ( conn->produce == NULL )
+            {
+                connCommandDone( conn );
+            }
+            continue;
         }
 
-        // Close the syslog connection
-        closelog();
-        pthread_cancel( timestampThread );
+        if ( conn->state == CONN_SUBSCRIBED )
+        {
+            return 2;
+        }
+
+        if ( conn->state == CONN_READING )
+        {
+            ssize_t bytesReceived = recv( conn->clientSocket, buffer, sizeof( buffer ), 0 );
+            if ( bytesReceived > 0 )
+            {
+                metricAdd( &threadMetrics()->bytesIn, bytesReceived );
+                conn->commandStart = metricsNow();
+                if ( connHandleCommand( conn, buffer, bytesReceived ) == -1 )
+                {
+                    return -1;
+                }
+                // A streamed response is timed until its last chunk is produced
+                if ( conn->produce == NULL )
+                {
+                    connCommandDone( conn );
+                }
+                continue;
+            }
+            if ( bytesReceived == 0 )
+            {
+                // Client is done sending, reopen the file to send its full content back
+                close( conn->dataFd );
+                conn->dataFd = open( DATA_FILE, O_RDONLY );
+                if ( conn->dataFd == -1 )
+                {
+                    syslog( LOG_ERR, "Failed to open file %s: %s", DATA_FILE, strerror( errno ) );
+                    return -1;
+                }
+                conn->state = CONN_DUMPING;
+                continue;
+            }
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                return 0;
+            }
+            syslog( LOG_ERR, "Failed to receive data: %s", strerror( errno ) );
+            return -1;
+        }
 
-        // Iterate over the thread list and join each thread
-        struct ThreadInfo *currentThread, *nextThread;
-        SLIST_FOREACH_SAFE( currentThread, &threadHead, entries, nextThread )
+        // CONN_DUMPING: lock one chunk at a time, never across a send to a slow client
+        lockRead( &dataFileLock, LOCK_DATA_FILE );
+        ssize_t bytesRead = read( conn->dataFd, buffer, sizeof( buffer ) );
+        pthread_rwlock_unlock( &dataFileLock );
+        if ( bytesRead > 0 )
+        {
+            if ( connQueue( conn, buffer, bytesRead ) == -1 )
+            {
+                return -1;
+            }
+            continue;
+        }
+        if ( bytesRead == -1 )
         {
-            pthread_join( currentThread->threadId, NULL );
-            SLIST_REMOVE( &threadHead, currentThread, ThreadInfo, entries );
-            free( currentThread );
+            syslog( LOG_ERR, "Failed to read file %s: %s", DATA_FILE, strerror( errno ) );
+            return -1;
         }
-        // Exit
-        exit( 0 );
+        return 1;
     }
 }
 
-// Function to retrieve the last 10 entries from the database and send them to the client
-int sendLast10Entries( int clientSocket )
+// Serve one client connection on a blocking socket until it is closed
+void serveClient ( int clientSocket )
 {
-    char *sql = "SELECT * FROM sensor_data ORDER BY timestamp DESC LIMIT 10;";
-    sqlite3_stmt *stmt;
+    // The whole per-connection context lives on this worker's stack
+    struct Connection conn;
 
-    // Prepare the SQL statement
-    if ( sqlite3_prepare_v2( db, sql, -1, &stmt, 0 ) != SQLITE_OK )
+    if ( connInit( &conn, clientSocket ) == -1 )
     {
-        syslog( LOG_ERR, "SQL error: %s", sqlite3_errmsg( db ) );
-        return -1;
+        close( clientSocket );
+        return;
     }
 
-    // Create a buffer to hold the data to send
-    char buffer[1536];
+    // On a blocking socket connService only returns 0 once a pool idle timeout expired
+    int result = connService( &conn );
+    if ( result == 0 )
+    {
+        syslog( LOG_INFO, "Closing idle connection from %s", conn.ipAddress );
+    }
+    if ( result == 2 )
+    {
+        feedSubscribe( &conn );
+    }
+    connRelease( &conn );
+}
 
-    // Initialize buffer position
-    int bufferPos = 0;
+// Thread-per-connection entry point
+void *handleClient ( void *arg )
+{
+    // Get thread information from the argument
+    struct ThreadInfo *threadInfo = ( struct ThreadInfo * ) arg;
 
-    // Send each row to the client
-    while ( sqlite3_step( stmt ) == SQLITE_ROW )
+    metricsThreadStart( ROLE_CONNECTION );
+    serveClient( threadInfo->clientSocket );
+
+    threadInfo->threadComplete = true;
+    pthread_exit( NULL );
+}
+
+// Pool worker: serve queued sockets one after another
+void *poolWorker ( void *arg )
+{
+    struct WorkerPool *pool = ( struct WorkerPool * ) arg;
+
+    metricsThreadStart( ROLE_POOL );
+    lockMutex( &pool->lock, LOCK_WORKER_POOL );
+    int slot = pool->slotCount++;
+    pthread_mutex_unlock( &pool->lock );
+
+    while ( 1 )
     {
-        const unsigned char *timestamp = sqlite3_column_text( stmt, 0 );
-        const unsigned char *temperature = sqlite3_column_text( stmt, 1 );
-        const unsigned char *humidity = sqlite3_column_text( stmt, 2 );
-        const unsigned char *pressure = sqlite3_column_text( stmt, 3 );
+        lockMutex( &pool->lock, LOCK_WORKER_POOL );
+        while ( STAILQ_EMPTY( &pool->pending ) && !pool->stopping )
+        {
+            pthread_cond_wait( &pool->notEmpty, &pool->lock );
+        }
+        if ( STAILQ_EMPTY( &pool->pending ) )
+        {
+            // Stopping and nothing left to serve
+            pthread_mutex_unlock( &pool->lock );
+            break;
+        }
 
-        // Format the data and append it to the buffer
-        bufferPos += snprintf( buffer + bufferPos, sizeof( buffer ) - bufferPos,
-                              "Timestamp: %s, Temperature: %s, Humidity: %s, Pressure: %s\n",
-                              timestamp, temperature, humidity, pressure );
-    }
+        // Take the oldest socket and give its node back before serving
+        struct Job *job = STAILQ_FIRST( &pool->pending );
+        STAILQ_REMOVE_HEAD( &pool->pending, entries );
+        int clientSocket = job->clientSocket;
+        STAILQ_INSERT_TAIL( &pool->freeJobs, job, entries );
+        pthread_cond_signal( &pool->notFull );
+        bool stopping = pool->stopping;
+        if ( !stopping )
+        {
+            pool->serving[slot] = clientSocket;
+        }
+        pthread_mutex_unlock( &pool->lock );
 
-    // Finalize the statement
-    sqlite3_finalize( stmt );
+        // Clients still queued at shutdown are closed rather than served
+        if ( stopping )
+        {
+            close( clientSocket );
+            continue;
+        }
+
+        // Bound how long one client can hold this worker without making progress
+        struct timeval timeout = { .tv_sec = POOL_IDLE_TIMEOUT_S };
+        setsockopt( clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+        setsockopt( clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+        serveClient( clientSocket );
+
+        lockMutex( &pool->lock, LOCK_WORKER_POOL );
+        pool->serving[slot] = -1;
+        pthread_mutex_unlock( &pool->lock );
+    }
+    return NULL;
+}
 
-    // Send the buffer data over the socket connection
-    if ( send( clientSocket, buffer, strlen( buffer ), 0 ) == -1 )
+// Allocate the job nodes and start the worker threads
+int poolStart ( struct WorkerPool *pool, int threadCount, int depth )
+{
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->notEmpty, NULL );
+    pthread_cond_init( &pool->notFull, NULL );
+    STAILQ_INIT( &pool->pending );
+    STAILQ_INIT( &pool->freeJobs );
+    pool->stopping = false;
+    pool->threadCount = 0;
+
+    pool->jobs = calloc( depth, sizeof( struct Job ) );
+    pool->threads = calloc( threadCount, sizeof( pthread_t ) );
+    pool->serving = calloc( threadCount, sizeof( int ) );
+    if ( pool->jobs == NULL || pool->threads == NULL || pool->serving == NULL )
     {
-        syslog( LOG_ERR, "Failed to send data: %s", strerror( errno ) );
+        syslog( LOG_ERR, "Failed to allocate memory" );
+        free( pool->jobs );
+        free( pool->threads );
+        free( pool->serving );
         return -1;
     }
+    for ( int i = 0; i < depth; i++ )
+    {
+        STAILQ_INSERT_TAIL( &pool->freeJobs, &pool->jobs[i], entries );
+    }
+    for ( int i = 0; i < threadCount; i++ )
+    {
+        pool->serving[i] = -1;
+    }
 
-    // write to the File
-    if ( write( fd, buffer, strlen( buffer ) ) == -1 )
+    for ( int i = 0; i < threadCount; i++ )
     {
-        // Handle error
-        syslog( LOG_ERR, "Failed to write to file %s: %s", DATA_FILE, strerror( errno ) );
-        return -1;
+        if ( startThread( &pool->threads[i], poolWorker, pool ) != 0 )
+        {
+            syslog( LOG_ERR, "Failed to create worker thread" );
+            break;
+        }
+        pool->threadCount++;
     }
-    return 0;
+    return pool->threadCount ? 0 : -1;
 }
 
-// Function to handle client connections
-void *handleClient ( void *arg )
+// Hand an accepted socket to the pool, waiting while the queue is full
+int poolSubmit ( struct WorkerPool *pool, int clientSocket )
 {
-    // Get thread information from the argument
-    struct ThreadInfo *threadInfo = ( struct ThreadInfo * ) arg;
-    int clientSocket = threadInfo->clientSocket;
-    struct sockaddr_in clientAddr;
-    socklen_t addrSize = sizeof( clientAddr );
-
-    // Get client address information
-    if ( getpeername( clientSocket, ( struct sockaddr * )&clientAddr, &addrSize ) == -1 )
+    lockMutex( &pool->lock, LOCK_WORKER_POOL );
+    while ( STAILQ_EMPTY( &pool->freeJobs ) && !pool->stopping && !exitRequested )
     {
-        // Log an error if getting client address fails
-        syslog( LOG_ERR, "Failed to get client address: %s", strerror( errno ) );
-        close( clientSocket );
-        threadInfo->threadComplete = true;
-        pthread_exit( NULL );
+        struct timespec deadline;
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_nsec += POOL_SUBMIT_WAKE_MS * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L )
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait( &pool->notFull, &pool->lock, &deadline );
+    }
+    if ( pool->stopping || exitRequested )
+    {
+        pthread_mutex_unlock( &pool->lock );
+        return -1;
     }
 
-    // Declare variables to store client IP address
-    char ipAddress[INET_ADDRSTRLEN];
-
-    // Convert the client IP address to a string format
-    inet_ntop( AF_INET, &clientAddr.sin_addr, ipAddress, sizeof( ipAddress ) );
-
-    // Log a message indicating the accepted connection
-    syslog( LOG_INFO, "Accepted connection from %s", ipAddress );
+    struct Job *job = STAILQ_FIRST( &pool->freeJobs );
+    STAILQ_REMOVE_HEAD( &pool->freeJobs, entries );
+    job->clientSocket = clientSocket;
+    STAILQ_INSERT_TAIL( &pool->pending, job, entries );
+    pthread_cond_signal( &pool->notEmpty );
+    pthread_mutex_unlock( &pool->lock );
+    return 0;
+}
 
-    // Declare buffer and variables for receiving data from the client
-    char buffer[1024];
-    ssize_t bytesReceived;
-    fd = open( DATA_FILE, O_CREAT | O_RDWR | O_APPEND, 0744 );
-    if ( fd == -1 )
+// Cut off the connections being served, let the workers close the queued
+// sockets, then join them
+void poolStop ( struct WorkerPool *pool )
+{
+    lockMutex( &pool->lock, LOCK_WORKER_POOL );
+    pool->stopping = true;
+    for ( int i = 0; i < pool->threadCount; i++ )
     {
-        // Handle error
-        syslog( LOG_ERR, "Failed to open file %s: %s", DATA_FILE, strerror( errno ) );
-        pthread_mutex_unlock( &mutex );
-        close( clientSocket );
-        threadInfo->threadComplete = true;
-        pthread_exit( NULL );
+        // Wakes a worker blocked on an idle client; the worker still closes the socket
+        if ( pool->serving[i] != -1 )
+        {
+            shutdown( pool->serving[i], SHUT_RDWR );
+        }
     }
+    pthread_cond_broadcast( &pool->notEmpty );
+    pthread_cond_broadcast( &pool->notFull );
+    pthread_mutex_unlock( &pool->lock );
 
-    // Receive data from the client
-    while ( ( bytesReceived = recv( clientSocket, buffer, sizeof( buffer ), 0 ) ) > 0 )
+    for ( int i = 0; i < pool->threadCount; i++ )
     {
-        // Print the received command
-        printf( "Received command from client: %s\n", buffer );
+        pthread_join( pool->threads[i], NULL );
+    }
+    free( pool->threads );
+    free( pool->serving );
+    free( pool->jobs );
+}
 
-        // Check if the received command is "get10"
-        if ( strncmp( buffer, "get10", 5 ) == 0 )
+// Accept every pending connection on the listening socket and register it
+static void reactorAccept( int epollFd )
+{
+    while ( 1 )
+    {
+        int clientSocket = accept4( serverSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( clientSocket == -1 )
         {
-            printf( "Received command: %s\n", buffer );
-            // Call function to retrieve the last 10 entries from the database and send them to the client
-            if ( sendLast10Entries( clientSocket ) )
+            if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !exitRequested )
             {
-                close( fd );
-                pthread_mutex_unlock( &mutex );
-                close( clientSocket );
-                threadInfo->threadComplete = true;
-                pthread_exit( NULL );
+                syslog( LOG_ERR, "Failed to accept: %s", strerror( errno ) );
             }
+            return;
         }
-        else
+        metricAdd( &threadMetrics()->accepts, 1 );
+
+        struct Connection *conn = malloc( sizeof( struct Connection ) );
+        if ( conn == NULL )
+        {
+            syslog( LOG_ERR, "Failed to allocate memory" );
+            close( clientSocket );
+            continue;
+        }
+        if ( connInit( conn, clientSocket ) == -1 )
+        {
+            close( clientSocket );
+            free( conn );
+            continue;
+        }
+
+        // Edge triggered: connService always drains until EAGAIN
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = conn;
+        if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, clientSocket, &event ) == -1 )
         {
-            // Handle other commands as needed
-            // Echo back the received data to the client
-            send( clientSocket, buffer, bytesReceived, 0 );
+            syslog( LOG_ERR, "Failed to register connection: %s", strerror( errno ) );
+            connRelease( conn );
+            free( conn );
         }
     }
-    pthread_mutex_lock( &mutex );
+}
+
+// Reactor thread: serves any number of connections from one epoll instance
+void *reactorLoop ( void *arg )
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
 
-    // Open the file in read mode to send the content back to the client
-    fd = open( DATA_FILE, O_RDWR );
-    if ( fd == -1 )
+    metricsThreadStart( ROLE_REACTOR );
+    int epollFd = epoll_create1( EPOLL_CLOEXEC );
+    if ( epollFd == -1 )
     {
-        // Log an error message if the file cannot be opened
-        syslog( LOG_ERR, "Failed to open file %s: %s", DATA_FILE, strerror( errno ) );
-        pthread_mutex_unlock( &mutex );
-        close( clientSocket );
-        threadInfo->threadComplete = true;
-        pthread_exit( NULL );
+        syslog( LOG_ERR, "Failed to create epoll instance: %s", strerror( errno ) );
+        return NULL;
     }
 
-    // Sending the full content of the file to the client
-    while ( ( bytesReceived = read( fd, buffer, sizeof( buffer ) ) ) > 0 )
+    // The listening socket is shared by all reactors; EPOLLEXCLUSIVE wakes only one of them
+    struct epoll_event listenEvent;
+    listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+    listenEvent.data.ptr = NULL;
+    if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, serverSocket, &listenEvent ) == -1 )
     {
-        send( clientSocket, buffer, bytesReceived, 0 );
+        syslog( LOG_ERR, "Failed to register listening socket: %s", strerror( errno ) );
+        close( epollFd );
+        return NULL;
     }
 
-    // Close the file
-    close( fd );
-    pthread_mutex_unlock( &mutex );
+    while ( 1 )
+    {
+        int eventCount = epoll_wait( epollFd, events, REACTOR_MAX_EVENTS, -1 );
+        if ( eventCount == -1 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            syslog( LOG_ERR, "Failed to wait for events: %s", strerror( errno ) );
+            break;
+        }
+
+        for ( int i = 0; i < eventCount; i++ )
+        {
+            struct Connection *conn = events[i].data.ptr;
+            if ( conn == NULL )
+            {
+                reactorAccept( epollFd );
+                continue;
+            }
 
-    // Close the client socket
-    close( clientSocket );
+            // Errors and hangups surface through recv/send inside connService
+            int result = connService( conn );
+            if ( result == 2 )
+            {
+                epoll_ctl( epollFd, EPOLL_CTL_DEL, conn->clientSocket, NULL );
+                feedSubscribe( conn );
+            }
+            if ( result != 0 )
+            {
+                connRelease( conn );
+                free( conn );
+            }
+        }
+    }
 
-    // Log a message indicating the closed connection
-    syslog( LOG_INFO, "Closed connection from %s", ipAddress );
-    threadInfo->threadComplete = true;
-    pthread_exit( NULL );
+    close( epollFd );
+    return NULL;
 }
 
 void *appendTimestamp ( void *arg )
@@ -250,7 +2174,9 @@ void *appendTimestamp ( void *arg )
     struct timespec currentTime;
     struct tm timeInfo;
     char timestamp[128];
+    FILE *filePointer;
 
+    metricsThreadStart( ROLE_TIMESTAMP );
     while ( 1 )
     {
         // Get current time with nanosecond precision
@@ -272,14 +2198,14 @@ void *appendTimestamp ( void *arg )
         // Format the timestamp string
         strftime( timestamp, sizeof( timestamp ), "timestamp:%a, %d %b %Y %T %z", &timeInfo );
 
-        pthread_mutex_lock( &mutex );
+        lockWrite( &dataFileLock, LOCK_DATA_FILE );
         // Open the file in append mode
         filePointer = fopen( DATA_FILE, "a" );
         if ( filePointer == NULL )
         {
             // Log an error if opening file fails
             syslog( LOG_ERR, "Failed to open file %s: %s", DATA_FILE, strerror( errno ) );
-            pthread_mutex_unlock( &mutex );
+            pthread_rwlock_unlock( &dataFileLock );
             pthread_exit( NULL );
         }
 
@@ -290,7 +2216,7 @@ void *appendTimestamp ( void *arg )
             // Log an error if writing timestamp fails
             syslog( LOG_ERR, "Failed to write timestamp to file" );
             fclose( filePointer );
-            pthread_mutex_unlock( &mutex );
+            pthread_rwlock_unlock( &dataFileLock );
             pthread_exit( NULL );
         }
 
@@ -300,12 +2226,12 @@ void *appendTimestamp ( void *arg )
             // Log an error if writing newline character fails
             syslog( LOG_ERR, "Failed to write newline character to file" );
             fclose( filePointer );
-            pthread_mutex_unlock( &mutex );
+            pthread_rwlock_unlock( &dataFileLock );
             pthread_exit( NULL );
         }
 
         fclose( filePointer );
-        pthread_mutex_unlock( &mutex );
+        pthread_rwlock_unlock( &dataFileLock );
 
         // Sleep for 10 seconds
         struct timespec sleepTime = {10, 0}; // 10 seconds
@@ -332,10 +2258,47 @@ int main ( int argc, char *argv[] )
     // Variable to determine if the program runs in daemon mode
     bool isDaemonMode = false;
 
-    // Check if the program is running in daemon mode
-    if ( argc > 1 && strcmp( argv[1], "-d" ) == 0 )
+    // Parse options: -d daemon mode, -e epoll reactor, -w <n> worker threads, -q <n> queue depth
+    int option;
+    while ( ( option = getopt( argc, argv, "dew:q:" ) ) != -1 )
     {
-        isDaemonMode = true;
+        switch ( option )
+        {
+            case 'd':
+                isDaemonMode = true;
+                break;
+            case 'e':
+                isReactorMode = true;
+                break;
+            case 'w':
+                workerCount = atoi( optarg );
+                if ( workerCount < 0 )
+                {
+                    workerCount = 0;
+                }
+                break;
+            case 'q':
+                queueDepth = atoi( optarg );
+                if ( queueDepth < 1 )
+                {
+                    queueDepth = 1;
+                }
+                break;
+            default:
+                fprintf( stderr, "Usage: %s [-d] [-e] [-w threads] [-q depth]\n"
+                                 "  -d  run as a daemon\n"
+                                 "  -e  serve connections from epoll reactor threads\n"
+                                 "  -w  with -e, reactor threads (default %d); without -e, serve\n"
+                                 "      connections from a pool of this many workers instead of one\n"
+                                 "      thread per connection (the default, also -w 0)\n"
+                                 "  -q  pool queue depth (default %d)\n"
+                                 "A pool worker serves one connection at a time, so at most -w clients are\n"
+                                 "served at once and the rest wait in the queue. A client that stays idle\n"
+                                 "for %d s is closed to free its worker.\n",
+                         argv[0], DEFAULT_REACTOR_THREADS, DEFAULT_QUEUE_DEPTH, POOL_IDLE_TIMEOUT_S );
+                closelog();
+                exit( -1 );
+        }
     }
 
     // Register signal handlers for SIGINT and SIGTERM
@@ -378,6 +2341,37 @@ int main ( int argc, char *argv[] )
         exit( 1 );
     }
 
+    // WAL lets the query threads read while bme280_measure writes; the mode is
+    // stored in the database file, so the writer picks it up as well
+    char *errMsg = NULL;
+    sqlite3_busy_timeout( db, DB_BUSY_TIMEOUT_MS );
+    if ( sqlite3_exec( db, "PRAGMA journal_mode=WAL;", NULL, NULL, &errMsg ) != SQLITE_OK )
+    {
+        syslog( LOG_WARNING, "Failed to enable WAL mode: %s", errMsg );
+        sqlite3_free( errMsg );
+    }
+
+    // Every thread lazily builds its own statement cache under this key
+    if ( pthread_key_create( &statementCacheKey, stmtCacheDestroy ) != 0 )
+    {
+        syslog( LOG_ERR, "Failed to create statement cache key" );
+        sqlite3_close( db );
+        closelog();
+        exit( 1 );
+    }
+
+    // Each thread registers its own counters, retired under this key when it exits
+    if ( pthread_key_create( &metricsKey, metricsThreadExit ) != 0 )
+    {
+        syslog( LOG_ERR, "Failed to create metrics key" );
+        sqlite3_close( db );
+        closelog();
+        exit( 1 );
+    }
+    metricsRegistry.startedNs = metricsNow();
+    LIST_INIT( &metricsRegistry.threads );
+    metricsThreadStart( ROLE_MAIN );
+
     // Flag to check if binding is successful
     bool isBindingSuccessful = false;
 
@@ -450,7 +2444,7 @@ int main ( int argc, char *argv[] )
     }
 
     // Start listening for incoming connections
-    if ( listen( serverSocket, 10 ) == -1 )
+    if ( listen( serverSocket, SOMAXCONN ) == -1 )
     {
         // Log an error message if listening fails
         syslog( LOG_ERR, "Failed to listen: %s", strerror( errno ) );
@@ -460,7 +2454,7 @@ int main ( int argc, char *argv[] )
 
 #if ( USE_AESD_CHAR_DEVICE == 0 )
     // Create thread for appending timestamp
-    if ( pthread_create( &timestampThread, NULL, appendTimestamp, NULL ) != 0 )
+    if ( startThread( &timestampThread, appendTimestamp, NULL ) != 0 )
     {
         // Log an error message if creating timestamp thread fails
         syslog( LOG_ERR, "Failed to create timestamp thread" );
@@ -469,53 +2463,150 @@ int main ( int argc, char *argv[] )
     }
 #endif
 
-    while ( 1 )
+    // Start pushing new samples to subscribers
+    if ( feedStart() == -1 )
     {
-        // Accept and handle incoming client connections
-        struct sockaddr_in clientAddr;
-        socklen_t addrSize = sizeof( clientAddr );
+        closelog();
+        exit( -1 );
+    }
 
-        int clientSocket = accept( serverSocket, ( struct sockaddr * ) &clientAddr, &addrSize );
-        if ( clientSocket == -1 )
+    if ( isReactorMode )
+    {
+        // The reactors accept from the listening socket without blocking
+        fcntl( serverSocket, F_SETFL, fcntl( serverSocket, F_GETFL ) | O_NONBLOCK );
+
+        if ( workerCount < 1 )
         {
-            // Log an error message if accepting connection fails
-            syslog( LOG_ERR, "Failed to accept: %s", strerror( errno ) );
-            continue;
+            workerCount = DEFAULT_REACTOR_THREADS;
         }
 
-        // Create a new thread info structure
-        struct ThreadInfo *threadInfo = ( struct ThreadInfo * )malloc( sizeof( struct ThreadInfo ) );
-        if ( threadInfo == NULL )
+        pthread_t reactorThread;
+        int reactorsStarted = 0;
+        for ( int i = 0; i < workerCount; i++ )
         {
-            syslog( LOG_ERR, "Failed to allocate memory" );
-            close( clientSocket );
-            continue;
+            if ( startThread( &reactorThread, reactorLoop, NULL ) != 0 )
+            {
+                syslog( LOG_ERR, "Failed to create reactor thread" );
+                break;
+            }
+            pthread_detach( reactorThread );
+            reactorsStarted++;
         }
-
-        threadInfo->clientSocket = clientSocket;
-        threadInfo->threadComplete = false;
-        // Create thread to handle client
-        if ( pthread_create( &threadInfo->threadId, NULL, handleClient, threadInfo ) != 0 )
+        if ( reactorsStarted == 0 )
         {
-            syslog( LOG_ERR, "Failed to create client handling thread" );
-            close( clientSocket );
-            free( threadInfo );
-            continue;
+            closelog();
+            exit( -1 );
         }
 
-        // Insert the thread info structure into the list
-        SLIST_INSERT_HEAD( &threadHead, threadInfo, entries );
+        // Signals are blocked in the reactors, so the main thread only waits for them
+        sigset_t blocked, previous;
+        sigemptyset( &blocked );
+        sigaddset( &blocked, SIGINT );
+        sigaddset( &blocked, SIGTERM );
+        pthread_sigmask( SIG_BLOCK, &blocked, &previous );
+        while ( !exitRequested )
+        {
+            sigsuspend( &previous );
+        }
+    }
+    else
+    {
+        // Thread per connection unless a pool size was asked for
+        bool usePool = workerCount > 0;
+        if ( usePool && poolStart( &workerPool, workerCount, queueDepth ) == -1 )
+        {
+            closelog();
+            exit( -1 );
+        }
 
-        // Join complete threads
-        struct ThreadInfo *currentThread, *nextThread;
-        SLIST_FOREACH_SAFE( currentThread, &threadHead, entries, nextThread )
+        while ( !exitRequested )
         {
-            if ( currentThread->threadComplete )
+            // Accept and handle incoming client connections
+            struct sockaddr_in clientAddr;
+            socklen_t addrSize = sizeof( clientAddr );
+
+            int clientSocket = accept( serverSocket, ( struct sockaddr * ) &clientAddr, &addrSize );
+            if ( clientSocket == -1 )
+            {
+                if ( !exitRequested )
+                {
+                    // Log an error message if accepting connection fails
+                    syslog( LOG_ERR, "Failed to accept: %s", strerror( errno ) );
+                }
+                continue;
+            }
+            metricAdd( &threadMetrics()->accepts, 1 );
+
+            if ( usePool )
+            {
+                // Waits while every queue slot is taken, pushing back on the listen backlog
+                if ( poolSubmit( &workerPool, clientSocket ) == -1 )
+                {
+                    close( clientSocket );
+                }
+                continue;
+            }
+
+            // Create a new thread info structure
+            struct ThreadInfo *threadInfo = ( struct ThreadInfo * )malloc( sizeof( struct ThreadInfo ) );
+            if ( threadInfo == NULL )
+            {
+                syslog( LOG_ERR, "Failed to allocate memory" );
+                close( clientSocket );
+                continue;
+            }
+
+            threadInfo->clientSocket = clientSocket;
+            threadInfo->threadComplete = false;
+            // Create thread to handle client
+            if ( startThread( &threadInfo->threadId, handleClient, threadInfo ) != 0 )
+            {
+                syslog( LOG_ERR, "Failed to create client handling thread" );
+                close( clientSocket );
+                free( threadInfo );
+                continue;
+            }
+
+            // Insert the thread info structure into the list
+            SLIST_INSERT_HEAD( &threadHead, threadInfo, entries );
+
+            // Join complete threads
+            struct ThreadInfo *currentThread, *nextThread;
+            SLIST_FOREACH_SAFE( currentThread, &threadHead, entries, nextThread )
             {
-                pthread_join( currentThread->threadId, NULL );
-                SLIST_REMOVE( &threadHead, currentThread, ThreadInfo, entries );
-                free( currentThread );
+                if ( currentThread->threadComplete )
+                {
+                    pthread_join( currentThread->threadId, NULL );
+                    SLIST_REMOVE( &threadHead, currentThread, ThreadInfo, entries );
+                    free( currentThread );
+                }
             }
         }
+
+        if ( usePool )
+        {
+            poolStop( &workerPool );
+        }
+    }
+
+    // Log a message indicating the signal caught
+    syslog( LOG_INFO, "Caught signal, exiting" );
+
+#if ( USE_AESD_CHAR_DEVICE == 0 )
+    pthread_cancel( timestampThread );
+    pthread_join( timestampThread, NULL );
+#endif
+
+    // Iterate over the thread list and join each thread
+    struct ThreadInfo *currentThread, *nextThread;
+    SLIST_FOREACH_SAFE( currentThread, &threadHead, entries, nextThread )
+    {
+        pthread_join( currentThread->threadId, NULL );
+        SLIST_REMOVE( &threadHead, currentThread, ThreadInfo, entries );
+        free( currentThread );
     }
-}
\ No newline at end of file
+
+    // Close the syslog connection
+    closelog();
+    exit( 0 );
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# Check that get10 answers from the in-memory sample ring exactly as the
+# QUERY_LAST_10 SQL would, while rows arrive in and out of timestamp order.
+# Usage: check_get10.py [path to aesdsocket]; run by make check
+import os
+import socket
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import time
+
+# Same as QUERY_LAST_10, with SQLite rendering the values as formatRow does
+LAST_10_SQL = ( "SELECT timestamp, CAST( temperature AS TEXT ), CAST( humidity AS TEXT ), CAST( pressure AS TEXT ) "
+                "FROM sensor_data ORDER BY timestamp DESC, rowid DESC LIMIT 10;" )
+
+# Longer than the feed's poll interval, so new rows have reached the ring
+SETTLE_S = 0.5
+
+DATA_FILE = "/dev/aesdchar"
+
+
+def insert( db, rows ):
+    db.executemany( "INSERT INTO sensor_data (timestamp, temperature, humidity, pressure) VALUES (?, ?, ?, ?);", rows )
+    db.commit()
+    time.sleep( SETTLE_S )
+
+
+def expected( db ):
+    return "".join( "Timestamp: %s, Temperature: %s, Humidity: %s, Pressure: %s\n" % row
+                    for row in db.execute( LAST_10_SQL ) )
+
+
+def get10():
+    with socket.create_connection( ( "127.0.0.1", 9000 ) ) as s:
+        s.sendall( b"get10" )
+        s.settimeout( 0.5 )
+        response = b""
+        try:
+            while True:
+                data = s.recv( 4096 )
+                if not data:
+                    break
+                response += data
+        except socket.timeout:
+            pass
+    return response.decode()
+
+
+def rows( timestamps, seed ):
+    return [ ( t, 20 + ( t + seed ) % 97 / 7, 40 + seed, 1000 + t % 13 / 3 ) for t in timestamps ]
+
+
+def main():
+    server = os.path.abspath( sys.argv[1] if len( sys.argv ) > 1 else "./aesdsocket" )
+    createdDataFile = not os.path.exists( DATA_FILE )
+    failures = 0
+
+    with tempfile.TemporaryDirectory() as directory:
+        db = sqlite3.connect( os.path.join( directory, "finalProject.db" ) )
+        db.execute( "CREATE TABLE sensor_data (id INTEGER PRIMARY KEY AUTOINCREMENT, timestamp INTEGER, "
+                    "temperature REAL, humidity REAL, pressure REAL);" )
+        db.execute( "CREATE INDEX sensor_data_timestamp ON sensor_data (timestamp);" )
+        db.execute( "PRAGMA journal_mode=WAL;" )
+        insert( db, rows( [ 1005, 1001, 1003, 1003 ], 0 ) )
+
+        process = subprocess.Popen( [ server ], cwd=directory )
+        try:
+            time.sleep( SETTLE_S )
+            steps = [
+                ( "warm, fewer rows than get10 returns", [] ),
+                ( "out of order while the ring is not full", rows( [ 1002, 1006, 1003, 1000 ], 1 ) ),
+                ( "ring overflows", rows( range( 2000, 2400 ), 2 ) ),
+                ( "replayed rows older than the ring", rows( range( 500, 520 ), 3 ) ),
+                ( "rows inside the ring and equal timestamps", rows( [ 2395, 2399, 2399, 2397, 2350 ], 4 ) ),
+                ( "new latest rows", rows( [ 2401, 2400, 2402 ], 5 ) ),
+            ]
+            for name, newRows in steps:
+                if newRows:
+                    insert( db, newRows )
+                want = expected( db )
+                got = get10()
+                if got != want:
+                    failures += 1
+                    print( "FAIL %s\n--- expected\n%s--- got\n%s" % ( name, want, got ) )
+                else:
+                    print( "ok   %s" % name )
+        finally:
+            process.terminate()
+            process.wait()
+            db.close()
+            if createdDataFile and os.path.isfile( DATA_FILE ):
+                os.remove( DATA_FILE )
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit( main() )